@@ -0,0 +1,367 @@
+// Time the text and graphics paths which have been tuned for speed, so
+// that changes to them can be measured, then print how the caches
+// behind them fared. Run it from the build directory, where the fonts
+// are, with Qt's offscreen platform to keep the window off the screen:
+//
+//     QT_QPA_PLATFORM=offscreen garglk/bench/garglk-bench
+//
+// Settings from garglk.ini apply, so only compare runs which share one.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef GARGLK_BENCH_QT
+#include <QImage>
+#include <QPainter>
+#endif
+
+#include "format.h"
+#include "garglk.h"
+
+namespace {
+
+// Run "func" "reps" times, "runs" times over, and return the fastest
+// run's time per repetition, in microseconds.
+double time_us(int runs, int reps, const std::function<void()> &func)
+{
+    double best = 0;
+
+    for (int run = 0; run < runs; run++) {
+        auto start = std::chrono::steady_clock::now();
+        for (int rep = 0; rep < reps; rep++) {
+            func();
+        }
+        std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+
+        double us = elapsed.count() / reps;
+        best = run == 0 ? us : std::min(best, us);
+    }
+
+    return best;
+}
+
+void report(const std::string &name, double us)
+{
+    if (us >= 1000) {
+        std::cout << Format("{:<36} {:10.2f} ms\n", name, us / 1000);
+    } else {
+        std::cout << Format("{:<36} {:10.3f} us\n", name, us);
+    }
+}
+
+// Print about "size" bytes of words, changing style every 50 words,
+// without a line break, so the text buffer has to wrap it as it goes.
+void print_paragraph(std::size_t size)
+{
+    static const std::vector<std::string> words = {
+        "the", "mailbox", "is", "small", "and", "white", "west", "of",
+        "house", "you", "are", "standing", "in", "an", "open", "field",
+        "with", "a", "boarded", "front", "door", "there", "leaflet",
+    };
+
+    std::size_t printed = 0;
+    for (std::size_t i = 0; printed < size; i++) {
+        if (i % 50 == 0) {
+            glk_set_style(i % 100 == 0 ? style_Emphasized : style_Normal);
+        }
+
+        const auto &word = words[(i * 7 + i / 3) % words.size()];
+        glk_put_buffer(const_cast<char *>(word.data()), word.size());
+        glk_put_char(' ');
+        printed += word.size() + 1;
+    }
+
+    glk_set_style(style_Normal);
+    glk_put_char('\n');
+}
+
+// Printing one long paragraph: each character appended has to be
+// measured to find where the line wraps.
+void bench_paragraph()
+{
+    winid_t win = glk_window_open(nullptr, 0, 0, wintype_TextBuffer, 0);
+    glk_set_window(win);
+
+    report("print 100KB paragraph", time_us(5, 1, [&]() {
+        glk_window_clear(win);
+        print_paragraph(100000);
+    }));
+
+    glk_window_close(win, nullptr);
+}
+
+// Matching ligatures in text which is full of them, with the per-font
+// trie and with the linear search of the whole ligature list which it
+// replaced. The search also asked FreeType, on every match, whether the
+// font had the ligature, which isn't counted here.
+void bench_ligatures()
+{
+    static const std::vector<std::pair<std::vector<glui32>, glui32>> ligatures = {
+        {{'f', 'f', 'i'}, UNI_LIG_FFI},
+        {{'f', 'f', 'l'}, UNI_LIG_FFL},
+        {{'f', 'f'}, UNI_LIG_FF},
+        {{'f', 'i'}, UNI_LIG_FI},
+        {{'f', 'l'}, UNI_LIG_FL},
+    };
+
+    garglk::LigatureTrie trie;
+    for (const auto &[chars, ligature] : ligatures) {
+        trie.add(chars, ligature);
+    }
+
+    const std::string sentence = "the official affluent waffle baffled five fluffy firefighters in the office of the flotilla ";
+    std::vector<glui32> text;
+    while (text.size() < 200000) {
+        text.insert(text.end(), sentence.begin(), sentence.end());
+    }
+
+    // Use what was matched, so the loops can't be optimized away.
+    glui32 sum = 0;
+
+    report("ligatures 200K chars, find_if", time_us(5, 5, [&]() {
+        const glui32 *s = text.data();
+        std::size_t n = text.size();
+
+        while (n > 0) {
+            auto it = std::find_if(ligatures.begin(), ligatures.end(), [s, n](const std::pair<std::vector<glui32>, glui32> &ligentry) {
+                const auto &ligature = ligentry.first;
+                if (ligature.size() > n) {
+                    return false;
+                }
+
+                for (std::size_t i = 0; i < ligature.size(); i++) {
+                    if (s[i] != ligature[i]) {
+                        return false;
+                    }
+                }
+
+                return true;
+            });
+
+            std::size_t consumed = 1;
+            if (it != ligatures.end()) {
+                sum += it->second;
+                consumed = it->first.size();
+            } else {
+                sum += *s;
+            }
+            s += consumed;
+            n -= consumed;
+        }
+    }));
+
+    report("ligatures 200K chars, trie", time_us(5, 5, [&]() {
+        const glui32 *s = text.data();
+        std::size_t n = text.size();
+
+        while (n > 0) {
+            std::size_t consumed;
+            sum += trie.match(s, n, consumed);
+            s += consumed;
+            n -= consumed;
+        }
+    }));
+
+    if (sum == 0) {
+        std::cout << "\n";
+    }
+}
+
+// Redrawing every line of a full text buffer window, and dragging a
+// selection over it.
+void bench_redraw(int width)
+{
+    // Tall enough for 100 lines of text, plus margins and a little slack.
+    gli_windows_size_change(width, 102 * gli_leading + 2 * gli_tmarginy, false);
+
+    winid_t win = glk_window_open(nullptr, 0, 0, wintype_TextBuffer, 0);
+    glk_set_window(win);
+
+    // More than enough wrapped text to fill every line.
+    print_paragraph(30000);
+    gli_windows_redraw();
+
+    int lines = win->winbuffer()->height;
+    report(Format("redraw {} visible lines", lines), time_us(5, 20, []() {
+        gli_force_redraw = true;
+        gli_windows_redraw();
+    }));
+    gli_force_redraw = false;
+
+    // Dragging a selection over the whole window: every line is selected,
+    // so every line has its selected characters found and is redrawn on
+    // each movement of the mouse, which has to fit in a frame (16.7 ms at
+    // 60 Hz) for the drag to keep up.
+    int right = win->bbox.x1 - 1;
+    int bottom = win->bbox.y1 - 1;
+    gli_start_selection(win->bbox.x0, win->bbox.y0);
+
+    int k = 0;
+    report(Format("drag selection over {} lines", lines), time_us(5, 20, [&]() {
+        // Alternate between two end points far enough apart to count as
+        // a movement.
+        int d = (k++ % 2) * 10;
+        gli_move_selection(right - d, bottom - d);
+    }));
+    gli_clear_selection();
+
+    glk_window_close(win, nullptr);
+}
+
+// Filling and erasing rectangles of a few sizes in a graphics window.
+void bench_fills()
+{
+    winid_t win = glk_window_open(nullptr, 0, 0, wintype_Graphics, 0);
+    gli_windows_redraw();
+
+    glui32 width, height;
+    glk_window_get_size(win, &width, &height);
+
+    struct Case {
+        std::string name;
+        glui32 w, h;
+        int reps;
+    };
+
+    std::vector<Case> cases = {
+        {"1x1", 1, 1, 200000},
+        {"8x8", 8, 8, 100000},
+        {Format("full ({}x{})", width, height), width, height, 500},
+    };
+
+    for (const auto &c : cases) {
+        // Move small rectangles around, so they don't always hit the
+        // same cache lines.
+        auto position = [&](int k, glsi32 &x, glsi32 &y) {
+            x = c.w < width ? (k * 7) % (width - c.w) : 0;
+            y = c.h < height ? (k * 3) % (height - c.h) : 0;
+        };
+
+        int k = 0;
+        report("fill " + c.name, time_us(5, c.reps, [&]() {
+            glsi32 x, y;
+            position(k, x, y);
+            glk_window_fill_rect(win, 0x102030 + k++, x, y, c.w, c.h);
+        }));
+
+        k = 0;
+        report("erase " + c.name, time_us(5, c.reps, [&]() {
+            glsi32 x, y;
+            position(k++, x, y);
+            glk_window_erase_rect(win, x, y, c.w, c.h);
+        }));
+    }
+
+    glk_window_close(win, nullptr);
+}
+
+// What the runs above did to each cache, and how long loading the fonts
+// took, to show whether the caches are sized well for this workload.
+void print_stats()
+{
+    const std::vector<std::pair<std::string, garglk::CacheStats>> caches = {
+        {"glyphs", garglk::glyph_cache_stats()},
+        {"text runs", garglk::text_run_cache_stats()},
+        {"glyph lookups", garglk::glyph_lookup_cache_stats()},
+        {"lines", garglk::line_cache_stats()},
+        {"pictures", garglk::picture_cache_stats()},
+    };
+
+    std::cout << Format("\n{:<14} {:>10} {:>10} {:>10} {:>8} {:>8} {:>10} {:>10}\n",
+        "cache", "hits", "misses", "evictions", "entries", "missing", "bytes", "capacity");
+    for (const auto &[name, stats] : caches) {
+        std::cout << Format("{:<14} {:>10} {:>10} {:>10} {:>8} {:>8} {:>10} {:>10}\n",
+            name, stats.hits, stats.misses, stats.evictions, stats.entries, stats.missing, stats.bytes, stats.capacity);
+    }
+
+    auto fonts = garglk::font_load_stats();
+    std::cout << Format("\nfonts loaded in {:.2f} ms ({:.2f} ms one after another)\n", fonts.load, fonts.serial);
+    if (fonts.warmup_done) {
+        std::cout << Format("{} glyphs warmed up in {:.2f} ms\n", fonts.glyphs_warmed, fonts.warmup);
+    } else {
+        std::cout << "glyph warmup not finished\n";
+    }
+}
+
+#ifdef GARGLK_BENCH_QT
+// Painting a full framebuffer into the window, the way View::paintEvent()
+// does, from both framebuffer layouts. Qt's backing store is RGB32 on X11,
+// Wayland and Windows; a 24-bit framebuffer has to be converted on every
+// paint, where an XRGB one can be copied.
+void bench_paint()
+{
+    struct Layout {
+        std::string name;
+        QImage::Format format;
+        int size;
+    };
+
+    const std::vector<Layout> layouts = {
+        {"RGB888", QImage::Format_RGB888, 3},
+        {"XRGB", QImage::Format_RGB32, 4},
+    };
+
+    struct Size {
+        std::string name;
+        int w, h;
+    };
+
+    const std::vector<Size> sizes = {
+        {"1080p", 1920, 1080},
+        {"4K", 3840, 2160},
+    };
+
+    for (const auto &size : sizes) {
+        QImage target(size.w, size.h, QImage::Format_RGB32);
+
+        for (const auto &layout : layouts) {
+            std::vector<unsigned char> framebuffer(std::size_t(size.w) * size.h * layout.size);
+            for (std::size_t i = 0; i < framebuffer.size(); i++) {
+                framebuffer[i] = i * 7;
+            }
+
+            QImage image(framebuffer.data(), size.w, size.h, size.w * layout.size, layout.format);
+
+            report(Format("paint {} from {}", size.name, layout.name), time_us(5, 10, [&]() {
+                QPainter painter(&target);
+                painter.drawImage(QPointF(0, 0), image, QRectF(0, 0, size.w, size.h));
+            }));
+        }
+    }
+
+    std::cout << Format("(this build draws into {})\n",
+        garglk::FramebufferLayout::size == 4 ? "XRGB" : "RGB888");
+}
+#endif
+
+}
+
+int main(int, char *argv[])
+{
+    char *args[] = {argv[0], nullptr};
+    garglk_startup(1, args);
+
+    constexpr int width = 1100;
+    gli_windows_size_change(width, 800, false);
+
+    bench_paragraph();
+    bench_ligatures();
+    bench_redraw(width);
+
+    gli_windows_size_change(width, 800, false);
+    bench_fills();
+
+#ifdef GARGLK_BENCH_QT
+    bench_paint();
+#endif
+
+    print_stats();
+
+    return EXIT_SUCCESS;
+}
@@ -847,6 +847,36 @@ static void gli_put_char_uni(stream_t *str, glui32 ch)
     }
 }
 
+static void gli_put_buffer_uni(stream_t *str, const glui32 *buf, glui32 len)
+{
+    glui32 lx;
+
+#ifdef GARGLK
+    /* Windows take the whole buffer at once, so that it's laid out and
+        redrawn once rather than per character. */
+    if (str && str->writable && str->type == strtype_Window) {
+        str->writecount += len;
+        if (str->win->line_request || str->win->line_request_uni) {
+            if (gli_conf_safeclicks && gli_forceclick) {
+                glk_cancel_line_event(str->win, nullptr);
+                gli_forceclick = false;
+            } else {
+                gli_strict_warning("put_buffer: window has pending line request");
+                return;
+            }
+        }
+        gli_window_put_buffer_uni(str->win, buf, len);
+        if (str->win->echostr)
+            gli_put_buffer_uni(str->win->echostr, buf, len);
+        return;
+    }
+#endif
+
+    for (lx=0; lx<len; lx++) {
+        gli_put_char_uni(str, buf[lx]);
+    }
+}
+
 #endif /* GLK_MODULE_UNICODE */
 
 static void gli_put_buffer(stream_t *str, char *buf, glui32 len)
@@ -914,8 +944,9 @@ static void gli_put_buffer(stream_t *str, char *buf, glui32 len)
                     break;
                 }
             }
-            for (lx = 0; lx < len; lx++) {
-                gli_window_put_char_uni(str->win, static_cast<unsigned char>(buf[lx]));
+            {
+                std::vector<glui32> unicode(reinterpret_cast<unsigned char *>(buf), reinterpret_cast<unsigned char *>(buf) + len);
+                gli_window_put_buffer_uni(str->win, unicode.data(), len);
             }
 #else
             if (str->win->line_request) {
@@ -978,12 +1009,9 @@ void gli_stream_echo_line(stream_t *str, char *buf, glui32 len)
 
 void gli_stream_echo_line_uni(stream_t *str, glui32 *buf, glui32 len)
 {
-    glui32 ix;
     /* This is only used to echo line input to an echo stream. See
         glk_select(). */
-    for (ix=0; ix<len; ix++) {
-        gli_put_char_uni(str, buf[ix]);
-    }
+    gli_put_buffer_uni(str, buf, len);
     gli_put_char(str, '\n');
 }
 
@@ -1639,55 +1667,31 @@ void glk_put_char_stream_uni(stream_t *str, glui32 ch)
 
 void glk_put_string_uni(glui32 *us)
 {
-    int len = 0;
-    glui32 val;
-
-    while (1) {
-        val = us[len];
-        if (!val)
-            break;
-        gli_put_char_uni(gli_currentstr, val);
-        len++;
-    }
+    gli_put_buffer_uni(gli_currentstr, us, gli_strlen_uni(us));
 }
 
 void glk_put_string_stream_uni(stream_t *str, glui32 *us)
 {
-    int len = 0;
-    glui32 val;
-
     if (!str) {
         gli_strict_warning("put_string_stream: invalid ref");
         return;
     }
 
-    while (1) {
-        val = us[len];
-        if (!val)
-            break;
-        gli_put_char_uni(str, val);
-        len++;
-    }
+    gli_put_buffer_uni(str, us, gli_strlen_uni(us));
 }
 
 void glk_put_buffer_uni(glui32 *buf, glui32 len)
 {
-    glui32 ix;
-    for (ix=0; ix<len; ix++) {
-        gli_put_char_uni(gli_currentstr, buf[ix]);
-    }
+    gli_put_buffer_uni(gli_currentstr, buf, len);
 }
 
 void glk_put_buffer_stream_uni(stream_t *str, glui32 *buf, glui32 len)
 {
-    glui32 ix;
     if (!str) {
         gli_strict_warning("put_string_stream: invalid ref");
         return;
     }
-    for (ix=0; ix<len; ix++) {
-        gli_put_char_uni(str, buf[ix]);
-    }
+    gli_put_buffer_uni(str, buf, len);
 }
 
 glsi32 glk_get_char_stream_uni(strid_t str)
@@ -65,6 +65,7 @@ typedef int32_t glsi32;
 #define GLK_MODULE_GARGLKBLEEP
 #define GLK_MODULE_GARGLKWINSIZE
 #define GLK_MODULE_GARGLK_FILE_RESOURCES
+#define GLK_MODULE_GARGLKPIXELS
 
 /* Define a macro for a function attribute that indicates a function that
     never returns. (E.g., glk_exit().) We try to do this only in C compilers
@@ -548,6 +549,25 @@ extern int garglk_tads_os_banner_size(winid_t win);
 
 extern void garglk_window_get_size_pixels(winid_t win, glui32 *width, glui32 *height);
 
+/* garglk_window_draw_pixels draws a whole image into a graphics window at
+ * once, for interpreters which would otherwise call glk_window_fill_rect()
+ * once per pixel. The image is "width" by "height" pixels, and each of its
+ * pixels is drawn as a "scale" by "scale" square, with the top left corner
+ * of the image at ("left", "top"). Coordinates are as for
+ * glk_window_fill_rect(), and so is the result: one call draws exactly
+ * what filling a rectangle for every pixel would.
+ *
+ * With pixels_Indexed, "pixels" is an array of bytes, each of which is an
+ * index into "palette"; with pixels_RGB, it's an array of glui32 colors.
+ * Colors are 0x00RRGGBB, as for glk_window_fill_rect(), and any color above
+ * 0x00FFFFFF is transparent, leaving the window as it was. Rows of the
+ * image are "stride" pixels apart. */
+#define pixels_Indexed (0)
+#define pixels_RGB (1)
+extern void garglk_window_draw_pixels(winid_t win, const void *pixels,
+    glui32 format, glui32 stride, const glui32 *palette,
+    glsi32 left, glsi32 top, glui32 width, glui32 height, glui32 scale);
+
 /* Some game formats include graphics and/or sound, but not in a Blorb file. To
  * support this, Gargoyle provides this function to add either an image or sound
  * resource from a file. If the resource was successfully read from the file,
@@ -263,9 +263,16 @@ bool gli_conf_per_game_config = true;
 GamedataLocation gli_conf_gamedata_location = GamedataLocation::Default;
 
 Scaler gli_conf_scaler = Scaler::None;
+ImageFilter gli_conf_image_filter = ImageFilter::Classic;
 
 GameInfoShow gli_conf_game_info = GameInfoShow::Once;
 
+std::size_t gli_conf_glyph_cache_size = 32 * 1024 * 1024;
+std::size_t gli_conf_line_cache_size = 16 * 1024 * 1024;
+std::size_t gli_conf_picture_cache_size = 32 * 1024 * 1024;
+
+int gli_conf_scrollback = 0;
+
 std::string garglk::downcase(const std::string &string)
 {
     std::string lowered;
@@ -753,6 +760,8 @@ static void readoneconfig(const std::string &fname, const std::string &argv0, co
                 parsecolor(arg, gli_scroll_bg);
             } else if (cmd == "scrollfg") {
                 parsecolor(arg, gli_scroll_fg);
+            } else if (cmd == "scrollback") {
+                gli_conf_scrollback = config_atleast(parse_int(arg), 0);
             } else if (cmd == "justify") {
                 gli_conf_justify = asbool(arg);
             } else if (cmd == "quotes") {
@@ -815,6 +824,18 @@ static void readoneconfig(const std::string &fname, const std::string &argv0, co
 #else
                 throw ConfigError("this build of Gargoyle does not have support for scalers");
 #endif
+            } else if (cmd == "image_filter") {
+                if (arg == "classic") {
+                    gli_conf_image_filter = ImageFilter::Classic;
+                } else if (arg == "box") {
+                    gli_conf_image_filter = ImageFilter::Box;
+                } else if (arg == "bilinear") {
+                    gli_conf_image_filter = ImageFilter::Bilinear;
+                } else if (arg == "lanczos") {
+                    gli_conf_image_filter = ImageFilter::Lanczos;
+                } else {
+                    throw ConfigError(Format("invalid value: {} (must be one of classic, box, bilinear, lanczos)", arg));
+                }
             } else if (cmd == "wait_on_quit") {
                 gli_wait_on_quit = asbool(arg);
             } else if (cmd == "speak") {
@@ -891,6 +912,12 @@ static void readoneconfig(const std::string &fname, const std::string &argv0, co
                 }
             } else if (cmd == "redraw_hack") {
                 gli_conf_redraw_hack = asbool(arg);
+            } else if (cmd == "glyph_cache_size") {
+                gli_conf_glyph_cache_size = static_cast<std::size_t>(config_atleast(parse_int(arg), 1)) * 1024 * 1024;
+            } else if (cmd == "line_cache_size") {
+                gli_conf_line_cache_size = static_cast<std::size_t>(config_atleast(parse_int(arg), 0)) * 1024 * 1024;
+            } else if (cmd == "picture_cache_size") {
+                gli_conf_picture_cache_size = static_cast<std::size_t>(config_atleast(parse_int(arg), 0)) * 1024 * 1024;
             } else if (cmd == "glyph_substitution_file") {
                 std::istringstream argstream(arg);
                 std::string style, file;
@@ -19,18 +19,31 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
+#include <chrono>
 #include <cmath>
+#include <condition_variable>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
 #include <functional>
 #include <iostream>
+#include <list>
+#include <mutex>
 #include <optional>
 #include <stdexcept>
 #include <string>
+#include <system_error>
+#include <thread>
 #include <unordered_map>
 #include <utility>
 #include <vector>
 
 #include "format.h"
+#include "gammablend.h"
+#include "simd.h"
 
 #include "glk.h"
 #include "garglk.h"
@@ -49,29 +62,189 @@ using namespace std::literals;
 
 #define UNICODE_QUESTION_MARK 63
 
-#define GAMMA_BITS 11
-#define GAMMA_MAX ((1 << GAMMA_BITS) - 1)
-
 #define mul255(a, b) ((static_cast<short>(a) * (b) + 127) / 255)
-#define mulhigh(a, b) ((static_cast<int>(a) * (b) + (1 << (GAMMA_BITS - 1)) - 1) / GAMMA_MAX)
 #define grayscale(r, g, b) ((30 * (r) + 59 * (g) + 11 * (b)) / 100)
 
 static std::string convert_ft_error(FT_Error err, const std::string &basemsg);
 
+// Faces are loaded from several threads at once, and FreeType requires
+// creating and destroying faces on a shared library to be serialized.
+static std::mutex ftlib_mutex;
+
 namespace {
 
 struct Bitmap {
     int w, h, lsb, top, pitch;
-    std::vector<unsigned char> data;
+    const unsigned char *data;
 };
 
+class Font;
+
+// A glyph as seen by the string renderer: the font it comes from (which
+// may be a substitution font) and its advance. The bitmap for each
+// subpixel offset is only rendered when it's first drawn.
 struct FontEntry {
+    Font *font;
+    FT_UInt gid;
     int adv;
-    std::array<Bitmap, GLI_SUBPIX> glyph;
+
+    const Bitmap &bitmap(int subpix) const;
+};
+
+// Rendered glyph bitmaps for all fonts. Bitmaps are copied into atlas
+// pages, each of which belongs to a single font and is filled
+// sequentially, so glyphs from the same font are packed together. When
+// the total size exceeds gli_conf_glyph_cache_size, the least recently
+// used page is dropped along with every glyph on it.
+//
+// A Bitmap returned from find() or insert() is valid until the next
+// call to insert().
+class GlyphCache {
+public:
+    // Glyph index * GLI_SUBPIX + subpixel offset.
+    using Key = std::uint32_t;
+
+    const Bitmap *find(std::size_t font, Key key);
+    const Bitmap &insert(std::size_t font, Key key, const FT_Bitmap &ftbitmap, int lsb, int top);
+    garglk::CacheStats stats() const;
+
+private:
+    static constexpr std::size_t PAGE_SIZE = 64 * 1024;
+
+    struct Page {
+        explicit Page(std::size_t font_, std::size_t size) : font(font_), data(size) {
+        }
+
+        std::size_t font;
+        std::vector<unsigned char> data;
+        std::size_t used = 0;
+        std::uint64_t last_used = 0;
+        std::vector<Key> keys;
+    };
+
+    using PageIter = std::list<Page>::iterator;
+
+    struct Entry {
+        PageIter page;
+        Bitmap bitmap;
+    };
+
+    static std::uint64_t fullkey(std::size_t font, Key key) {
+        return (static_cast<std::uint64_t>(font) << 32) | key;
+    }
+
+    PageIter page_for(std::size_t font, std::size_t size);
+    void evict_lru();
+
+    std::list<Page> m_pages;
+    std::unordered_map<std::size_t, PageIter> m_current;
+    std::unordered_map<std::uint64_t, Entry> m_entries;
+    std::uint64_t m_tick = 0;
+    std::size_t m_bytes = 0;
+    garglk::CacheStats m_stats;
+};
+
+// Layouts of recently measured runs of text, keyed on font face, space
+// width and the text itself, so that measuring the same words over and
+// over (as line wrapping and justification in text buffers do) doesn't
+// go through ligature, fallback and kerning lookups every time. The
+// least recently used runs are dropped once the total size exceeds
+// CACHE_SIZE.
+//
+// A TextRun returned from find() or insert() is valid until the next
+// call to insert().
+class TextRunCache {
+public:
+    const garglk::TextRun *find(FontFace face, int spw, const glui32 *text, std::size_t n);
+    const garglk::TextRun &insert(FontFace face, int spw, const glui32 *text, std::size_t n, garglk::TextRun run);
+    garglk::CacheStats stats() const;
+
+private:
+    static constexpr std::size_t CACHE_SIZE = 1024 * 1024;
+
+    struct Entry {
+        std::size_t hash;
+        FontFace face;
+        int spw;
+        std::vector<glui32> text;
+        garglk::TextRun run;
+
+        std::size_t size() const {
+            return sizeof(Entry) + text.size() * sizeof(glui32) + run.offsets.size() * sizeof(int);
+        }
+    };
+
+    static std::size_t hash(FontFace face, int spw, const glui32 *text, std::size_t n);
+
+    // Most recently used first.
+    std::list<Entry> m_lru;
+    std::unordered_map<std::size_t, std::list<Entry>::iterator> m_entries;
+    std::size_t m_bytes = 0;
+    garglk::CacheStats m_stats;
+};
+
+// The glyphs which characters have been resolved to for one font: from
+// the font itself, from a substitution font, or, if no font has the
+// character, the font's question mark. The last are remembered too, so
+// that a missing character isn't searched for (and warned about) every
+// time it's drawn. When the cache reaches CACHE_SIZE bytes, the least
+// recently used quarter of it is dropped.
+//
+// A FontEntry returned from find() or insert() is valid until the next
+// call to insert().
+class GlyphLookupCache {
+public:
+    const FontEntry *find(glui32 c);
+    const FontEntry &insert(glui32 c, const FontEntry &entry, bool missing);
+    garglk::CacheStats stats() const;
+
+private:
+    static constexpr std::size_t CACHE_SIZE = 256 * 1024;
+
+    struct Entry {
+        FontEntry entry;
+        bool missing;
+        std::uint64_t last_used;
+    };
+
+    // Includes an estimate of the hash table's per-node overhead.
+    static constexpr std::size_t ENTRY_SIZE = sizeof(glui32) + sizeof(Entry) + 2 * sizeof(void *);
+
+    void evict();
+
+    std::unordered_map<glui32, Entry> m_entries;
+    std::size_t m_missing = 0;
+    std::uint64_t m_tick = 0;
+    garglk::CacheStats m_stats;
+};
+
+// Renders the glyphs for printable ASCII in every face on a background
+// thread once the fonts are loaded, so that the first screen of text
+// doesn't have to. While this is running, anything using the fonts or
+// the glyph caches must hold the lock returned by lock(); once it's
+// done, lock() returns an empty lock and no locking takes place.
+class FontWarmup {
+public:
+    FontWarmup() = default;
+    FontWarmup(const FontWarmup &) = delete;
+    FontWarmup &operator=(const FontWarmup &) = delete;
+    ~FontWarmup();
+
+    void start();
+    std::unique_lock<std::mutex> lock();
+
+private:
+    void run();
+
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::atomic<bool> m_running{false};
+    std::atomic<bool> m_stop{false};
 };
 
 struct UniqueFaceDeleter {
     void operator()(FT_Face face) const {
+        std::lock_guard<std::mutex> guard(ftlib_mutex);
         FT_Done_Face(face);
     }
 };
@@ -104,19 +277,49 @@ public:
     Font(FontFace fontface, UniqueFace face, const std::string &fontpath);
 
     FontEntry getglyph(glui32 cid);
+    const Bitmap &getbitmap(FT_UInt gid, int subpix);
     int charkern(glui32 c0, glui32 c1);
+    glui32 ligature(const glui32 *s, std::size_t n, std::size_t &len) const {
+        return m_ligatures.match(s, n, len);
+    }
+    std::size_t longest_ligature() const {
+        return m_ligatures.longest();
+    }
     const UniqueFace &face() {
         return m_face;
     }
+    GlyphLookupCache &lookups() {
+        return m_lookups;
+    }
 
 private:
+    // Kerning for pairs of characters in this range (Basic Latin and
+    // Latin-1) is computed in bulk when the font is loaded and stored
+    // in a dense table; anything else is looked up on demand.
+    static constexpr glui32 KERN_TABLE_FIRST = 0x20;
+    static constexpr glui32 KERN_TABLE_LAST = 0xff;
+    static constexpr glui32 KERN_TABLE_SIZE = KERN_TABLE_LAST - KERN_TABLE_FIRST + 1;
+
+    void load_glyph(FT_UInt gid);
+    int kern_pair(FT_UInt g0, FT_UInt g1);
+    void fill_kerntable();
+
+    std::size_t m_id;
     UniqueFace m_face;
     bool m_make_bold = false;
     bool m_make_oblique = false;
     bool m_kerned = false;
+    std::vector<int> m_kerntable;
     std::unordered_map<unsigned long long, int> m_kerncache;
+    garglk::LigatureTrie m_ligatures;
+    GlyphLookupCache m_lookups;
 };
 
+const Bitmap &FontEntry::bitmap(int subpix) const
+{
+    return font->getbitmap(gid, subpix);
+}
+
 }
 
 //
@@ -125,16 +328,23 @@ private:
 
 std::unordered_map<FontFace, std::vector<std::string>> gli_conf_glyph_substitution_files;
 
-static std::array<std::uint16_t, 256> gammamap;
-static std::array<unsigned char, 1 << GAMMA_BITS> gammainv;
+static GammaMap gammamap;
+static GammaInv gammainv;
 
 static std::unordered_map<FontFace, Font> gfont_table;
+static GlyphCache glyph_cache;
+static TextRunCache text_run_cache;
 static std::unordered_map<FontFace, std::vector<Font>> glyph_substitution_fonts;
+static garglk::FontLoadStats font_load_stats;
+
+// This must come after everything the warm-up thread uses, so that it's
+// destroyed (which stops the thread) before any of them.
+static FontWarmup font_warmup;
 
 int gli_cellw = 8;
 int gli_cellh = 8;
 
-Canvas<3> gli_image_rgb;
+Framebuffer gli_image_rgb;
 
 static FT_Library ftlib;
 static FT_Matrix ftmat;
@@ -188,69 +398,379 @@ static std::string convert_ft_error(FT_Error err, const std::string &basemsg)
 
 namespace {
 
+const Bitmap *GlyphCache::find(std::size_t font, Key key)
+{
+    auto it = m_entries.find(fullkey(font, key));
+    if (it == m_entries.end()) {
+        m_stats.misses++;
+        return nullptr;
+    }
+
+    m_stats.hits++;
+    it->second.page->last_used = ++m_tick;
+
+    return &it->second.bitmap;
+}
+
+const Bitmap &GlyphCache::insert(std::size_t font, Key key, const FT_Bitmap &ftbitmap, int lsb, int top)
+{
+    std::size_t datasize = ftbitmap.pitch * ftbitmap.rows;
+    auto page = page_for(font, datasize);
+
+    Bitmap bitmap;
+    bitmap.lsb = lsb;
+    bitmap.top = top;
+    bitmap.w = ftbitmap.width;
+    bitmap.h = ftbitmap.rows;
+    bitmap.pitch = ftbitmap.pitch;
+    bitmap.data = &page->data[page->used];
+
+    if (datasize != 0) {
+        std::memcpy(&page->data[page->used], ftbitmap.buffer, datasize);
+        page->used += datasize;
+    }
+
+    page->last_used = ++m_tick;
+    page->keys.push_back(key);
+
+    return m_entries.insert_or_assign(fullkey(font, key), Entry{page, bitmap}).first->second.bitmap;
+}
+
+// Return the font's current page if it has room for "size" more bytes,
+// else start a new page, evicting old pages if that would exceed the
+// cache size.
+GlyphCache::PageIter GlyphCache::page_for(std::size_t font, std::size_t size)
+{
+    auto current = m_current.find(font);
+    if (current != m_current.end()) {
+        auto &page = *current->second;
+        if (page.data.size() - page.used >= size) {
+            return current->second;
+        }
+    }
+
+    auto pagesize = std::max(PAGE_SIZE, size);
+    while (!m_pages.empty() && m_bytes + pagesize > gli_conf_glyph_cache_size) {
+        evict_lru();
+    }
+
+    m_pages.emplace_front(font, pagesize);
+    m_bytes += pagesize;
+    m_current[font] = m_pages.begin();
+
+    return m_pages.begin();
+}
+
+void GlyphCache::evict_lru()
+{
+    auto lru = std::min_element(m_pages.begin(), m_pages.end(), [](const Page &a, const Page &b) {
+        return a.last_used < b.last_used;
+    });
+
+    for (const auto &key : lru->keys) {
+        m_entries.erase(fullkey(lru->font, key));
+    }
+
+    auto current = m_current.find(lru->font);
+    if (current != m_current.end() && current->second == lru) {
+        m_current.erase(current);
+    }
+
+    m_stats.evictions += lru->keys.size();
+    m_bytes -= lru->data.size();
+    m_pages.erase(lru);
+}
+
+garglk::CacheStats GlyphCache::stats() const
+{
+    auto stats = m_stats;
+    stats.entries = m_entries.size();
+    stats.bytes = m_bytes;
+    stats.capacity = gli_conf_glyph_cache_size;
+
+    return stats;
+}
+
+std::size_t TextRunCache::hash(FontFace face, int spw, const glui32 *text, std::size_t n)
+{
+    std::size_t h = hash_combine(std::hash<FontFace>()(face), std::hash<int>()(spw));
+
+    for (std::size_t i = 0; i < n; i++) {
+        h = hash_combine(h, text[i]);
+    }
+
+    return h;
+}
+
+// Entries are indexed by hash alone. If two runs collide, the newer one
+// replaces the older, so a lookup has to compare the full key.
+const garglk::TextRun *TextRunCache::find(FontFace face, int spw, const glui32 *text, std::size_t n)
+{
+    auto it = m_entries.find(hash(face, spw, text, n));
+    if (it == m_entries.end()) {
+        m_stats.misses++;
+        return nullptr;
+    }
+
+    const auto &entry = *it->second;
+    if (!(entry.face == face) || entry.spw != spw || entry.text.size() != n ||
+        !std::equal(entry.text.begin(), entry.text.end(), text)) {
+
+        m_stats.misses++;
+        return nullptr;
+    }
+
+    m_stats.hits++;
+    m_lru.splice(m_lru.begin(), m_lru, it->second);
+
+    return &entry.run;
+}
+
+const garglk::TextRun &TextRunCache::insert(FontFace face, int spw, const glui32 *text, std::size_t n, garglk::TextRun run)
+{
+    auto h = hash(face, spw, text, n);
+
+    auto old = m_entries.find(h);
+    if (old != m_entries.end()) {
+        m_bytes -= old->second->size();
+        m_lru.erase(old->second);
+        m_entries.erase(old);
+    }
+
+    m_lru.push_front(Entry{h, face, spw, std::vector<glui32>(text, text + n), std::move(run)});
+    m_entries[h] = m_lru.begin();
+    m_bytes += m_lru.front().size();
+
+    while (m_bytes > CACHE_SIZE && m_lru.size() > 1) {
+        const auto &lru = m_lru.back();
+        m_bytes -= lru.size();
+        m_entries.erase(lru.hash);
+        m_lru.pop_back();
+        m_stats.evictions++;
+    }
+
+    return m_lru.front().run;
+}
+
+garglk::CacheStats TextRunCache::stats() const
+{
+    auto stats = m_stats;
+    stats.entries = m_lru.size();
+    stats.bytes = m_bytes;
+    stats.capacity = CACHE_SIZE;
+
+    return stats;
+}
+
+const FontEntry *GlyphLookupCache::find(glui32 c)
+{
+    auto it = m_entries.find(c);
+    if (it == m_entries.end()) {
+        m_stats.misses++;
+        return nullptr;
+    }
+
+    m_stats.hits++;
+    it->second.last_used = ++m_tick;
+
+    return &it->second.entry;
+}
+
+const FontEntry &GlyphLookupCache::insert(glui32 c, const FontEntry &entry, bool missing)
+{
+    if (m_entries.size() * ENTRY_SIZE >= CACHE_SIZE) {
+        evict();
+    }
+
+    auto [it, inserted] = m_entries.insert_or_assign(c, Entry{entry, missing, ++m_tick});
+    if (inserted && missing) {
+        m_missing++;
+    }
+
+    return it->second.entry;
+}
+
+void GlyphLookupCache::evict()
+{
+    std::vector<std::pair<std::uint64_t, glui32>> ages;
+    ages.reserve(m_entries.size());
+    for (const auto &[c, entry] : m_entries) {
+        ages.emplace_back(entry.last_used, c);
+    }
+
+    auto oldest = ages.begin() + ages.size() / 4;
+    std::nth_element(ages.begin(), oldest, ages.end());
+
+    for (auto age = ages.begin(); age != oldest; ++age) {
+        auto it = m_entries.find(age->second);
+        if (it->second.missing) {
+            m_missing--;
+        }
+        m_entries.erase(it);
+        m_stats.evictions++;
+    }
+}
+
+garglk::CacheStats GlyphLookupCache::stats() const
+{
+    auto stats = m_stats;
+    stats.entries = m_entries.size();
+    stats.missing = m_missing;
+    stats.bytes = m_entries.size() * ENTRY_SIZE;
+    stats.capacity = CACHE_SIZE;
+
+    return stats;
+}
+
+void Font::load_glyph(FT_UInt gid)
+{
+    int err = FT_Load_Glyph(m_face.get(), gid, FT_LOAD_NO_BITMAP | FT_LOAD_NO_HINTING);
+    if (err != 0) {
+        throw std::runtime_error(convert_ft_error(err, "FT_Load_Glyph"));
+    }
+
+    if (m_make_bold) {
+        FT_Outline_Embolden(&m_face->glyph->outline, FT_MulFix(m_face->units_per_EM, m_face->size->metrics.y_scale) / 24);
+    }
+
+    if (m_make_oblique) {
+        FT_Outline_Transform(&m_face->glyph->outline, &ftmat);
+    }
+}
+
+// Look up the glyph for the specified character, but don't render it:
+// that's done by getbitmap(), only for the subpixel offsets which are
+// actually drawn. The advance isn't affected by the subpixel offset, so
+// it's taken from an untranslated load.
 FontEntry Font::getglyph(glui32 cid)
+{
+    FT_UInt gid = FT_Get_Char_Index(m_face.get(), cid);
+    if (gid == 0) {
+        throw std::out_of_range(Format("no glyph for {}", cid));
+    }
+
+    FT_Set_Transform(m_face.get(), nullptr, nullptr);
+    load_glyph(gid);
+
+    return FontEntry{this, gid, static_cast<int>((m_face->glyph->advance.x * GLI_SUBPIX + 32) / 64)};
+}
+
+const Bitmap &Font::getbitmap(FT_UInt gid, int subpix)
 {
     FT_Vector v;
     int err;
-    glui32 gid;
-    FontEntry entry;
-    std::size_t datasize;
+    GlyphCache::Key key = gid * GLI_SUBPIX + subpix;
 
-    gid = FT_Get_Char_Index(m_face.get(), cid);
-    if (gid == 0) {
-        throw std::out_of_range(Format("no glyph for {}", cid));
+    const auto *cached = glyph_cache.find(m_id, key);
+    if (cached != nullptr) {
+        return *cached;
     }
 
-    for (int x = 0; x < GLI_SUBPIX; x++) {
-        v.x = (x * 64) / GLI_SUBPIX;
-        v.y = 0;
+    v.x = (subpix * 64) / GLI_SUBPIX;
+    v.y = 0;
 
-        FT_Set_Transform(m_face.get(), nullptr, &v);
+    FT_Set_Transform(m_face.get(), nullptr, &v);
 
-        err = FT_Load_Glyph(m_face.get(), gid,
-                FT_LOAD_NO_BITMAP | FT_LOAD_NO_HINTING);
-        if (err != 0) {
-            throw std::runtime_error(convert_ft_error(err, "FT_Load_Glyph"));
-        }
+    load_glyph(gid);
 
-        if (m_make_bold) {
-            FT_Outline_Embolden(&m_face->glyph->outline, FT_MulFix(m_face->units_per_EM, m_face->size->metrics.y_scale) / 24);
+    if (gli_conf_lcd) {
+        if (use_freetype_preset_filter) {
+            FT_Library_SetLcdFilter(ftlib, freetype_preset_filter);
+        } else {
+            FT_Library_SetLcdFilterWeights(ftlib, gli_conf_lcd_weights.data());
         }
 
-        if (m_make_oblique) {
-            FT_Outline_Transform(&m_face->glyph->outline, &ftmat);
-        }
+        err = FT_Render_Glyph(m_face->glyph, FT_RENDER_MODE_LCD);
+    } else {
+        err = FT_Render_Glyph(m_face->glyph, FT_RENDER_MODE_LIGHT);
+    }
 
-        if (gli_conf_lcd) {
-            if (use_freetype_preset_filter) {
-                FT_Library_SetLcdFilter(ftlib, freetype_preset_filter);
-            } else {
-                FT_Library_SetLcdFilterWeights(ftlib, gli_conf_lcd_weights.data());
-            }
+    if (err != 0) {
+        throw std::runtime_error(convert_ft_error(err, "FT_Render_Glyph"));
+    }
+
+    return glyph_cache.insert(m_id, key, m_face->glyph->bitmap, m_face->glyph->bitmap_left, m_face->glyph->bitmap_top);
+}
 
-            err = FT_Render_Glyph(m_face->glyph, FT_RENDER_MODE_LCD);
+}
+
+void garglk::LigatureTrie::add(const std::vector<glui32> &chars, glui32 ligature)
+{
+    std::size_t node = 0;
+
+    for (auto c : chars) {
+        auto &children = m_nodes[node].children;
+        auto child = std::find_if(children.begin(), children.end(), [c](const auto &child) {
+            return child.first == c;
+        });
+
+        if (child != children.end()) {
+            node = child->second;
         } else {
-            err = FT_Render_Glyph(m_face->glyph, FT_RENDER_MODE_LIGHT);
+            children.emplace_back(c, m_nodes.size());
+            node = m_nodes.size();
+            m_nodes.emplace_back();
         }
+    }
 
-        if (err != 0) {
-            throw std::runtime_error(convert_ft_error(err, "FT_Render_Glyph"));
-        }
+    m_nodes[node].ligature = ligature;
+    m_longest = std::max(m_longest, chars.size());
+}
 
-        datasize = m_face->glyph->bitmap.pitch * m_face->glyph->bitmap.rows;
-        entry.adv = (m_face->glyph->advance.x * GLI_SUBPIX + 32) / 64;
+glui32 garglk::LigatureTrie::match(const glui32 *s, std::size_t n, std::size_t &len) const
+{
+    glui32 ligature = s[0];
+    std::size_t node = 0;
+    len = 1;
+
+    for (std::size_t i = 0; i < n; i++) {
+        const auto &children = m_nodes[node].children;
+        auto child = std::find_if(children.begin(), children.end(), [c = s[i]](const auto &child) {
+            return child.first == c;
+        });
+
+        if (child == children.end()) {
+            break;
+        }
 
-        entry.glyph[x].lsb = m_face->glyph->bitmap_left;
-        entry.glyph[x].top = m_face->glyph->bitmap_top;
-        entry.glyph[x].w = m_face->glyph->bitmap.width;
-        entry.glyph[x].h = m_face->glyph->bitmap.rows;
-        entry.glyph[x].pitch = m_face->glyph->bitmap.pitch;
-        entry.glyph[x].data.assign(&m_face->glyph->bitmap.buffer[0], &m_face->glyph->bitmap.buffer[datasize]);
+        node = child->second;
+        if (m_nodes[node].ligature != 0) {
+            ligature = m_nodes[node].ligature;
+            len = i + 1;
+        }
     }
 
-    return entry;
+    return ligature;
+}
+
+garglk::CacheStats garglk::glyph_cache_stats()
+{
+    auto lock = font_warmup.lock();
+    return glyph_cache.stats();
+}
+
+garglk::CacheStats garglk::text_run_cache_stats()
+{
+    return text_run_cache.stats();
 }
 
+garglk::CacheStats garglk::glyph_lookup_cache_stats()
+{
+    auto lock = font_warmup.lock();
+    garglk::CacheStats total;
+
+    for (auto &[fontface, font] : gfont_table) {
+        auto stats = font.lookups().stats();
+        total.hits += stats.hits;
+        total.misses += stats.misses;
+        total.evictions += stats.evictions;
+        total.entries += stats.entries;
+        total.missing += stats.missing;
+        total.bytes += stats.bytes;
+        total.capacity += stats.capacity;
+    }
+
+    return total;
 }
 
 // Look in a system-wide location for the fallback Gargoyle fonts; on
@@ -297,9 +817,23 @@ static std::string fontface_to_name(FontFace fontface)
     return Format("{} {}", type, style);
 }
 
-static Font make_font(FontFace fontface, const std::string &fallback, std::vector<std::string> &problem_fonts)
+// The files to try for a font face, in order: the user-specified font,
+// if any, and then the fallback locations. These are looked up before
+// any fonts are loaded, since the fonts are loaded in parallel and the
+// platform code might not be thread-safe.
+struct FontPaths {
+    std::optional<std::string> path;
+    std::vector<std::string> fallbacks;
+    std::string notfound;
+};
+
+struct FontNotFound : public std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+static FontPaths font_paths(FontFace fontface, const std::string &fallback)
 {
-    std::vector<std::function<std::optional<std::string>(const std::string &fallback)>> font_paths = {
+    std::vector<std::function<std::optional<std::string>(const std::string &fallback)>> fallback_paths = {
         font_path_fallback_system,
         font_path_fallback_platform,
         font_path_fallback_local,
@@ -316,54 +850,83 @@ static Font make_font(FontFace fontface, const std::string &fallback, std::vecto
         fontface == FontFace::propz() ? gli_conf_prop.z :
                                         gli_conf_mono.r;
 
-    const auto &path = fontfiles.fontpath();
-    const auto &override = fontfiles.override;
+    FontPaths paths;
+
+    paths.path = fontfiles.fontpath();
+
+    for (const auto &get_font_path : fallback_paths) {
+        auto fontpath = get_font_path(fallback);
+        if (fontpath.has_value()) {
+            paths.fallbacks.push_back(*fontpath);
+        }
+    }
+
+    paths.notfound = Format("Unable to find font \"{}\" for {}, and fallback {} not found",
+            fontfiles.override.value_or(fontface.monospace ? gli_conf_monofont : gli_conf_propfont),
+            fontface_to_name(fontface),
+            fallback);
 
+    return paths;
+}
+
+static bool open_face(const std::string &path, FT_Face &face)
+{
+    std::lock_guard<std::mutex> guard(ftlib_mutex);
+    return FT_New_Face(ftlib, path.c_str(), 0, &face) == 0;
+}
+
+static Font make_font(FontFace fontface, const FontPaths &paths, std::vector<std::string> &problem_fonts)
+{
     // First look for a user-specified font. This will be either based
     // on a font family (propfont or monofont), or specific font files
     // (e.g. propr, monor, etc).
     std::optional<Font::LoadError> error;
     FT_Face face;
-    if (path.has_value() && FT_New_Face(ftlib, path->c_str(), 0, &face) == 0) {
+    if (paths.path.has_value() && open_face(*paths.path, face)) {
         try {
-            return {fontface, UniqueFace(face), *path};
+            return {fontface, UniqueFace(face), *paths.path};
         } catch (const Font::LoadError &e) {
             error = e;
         }
     }
 
     // If no user font can be loaded, try to find a fallback.
-    for (const auto &get_font_path : font_paths) {
-        auto fontpath = get_font_path(fallback);
-        if (fontpath.has_value() && FT_New_Face(ftlib, fontpath->c_str(), 0, &face) == 0) {
+    for (const auto &fontpath : paths.fallbacks) {
+        if (open_face(fontpath, face)) {
             if (error.has_value()) {
-                problem_fonts.push_back(Format("Unable to load font file \"{}\" ({}): using fallback {}.", error->filename(), error->what(), *fontpath));
+                problem_fonts.push_back(Format("Unable to load font file \"{}\" ({}): using fallback {}.", error->filename(), error->what(), fontpath));
             }
-            return {fontface, UniqueFace(face), *fontpath};
+            return {fontface, UniqueFace(face), fontpath};
         }
     }
 
-    garglk::winabort(Format("Unable to find font \"{}\" for {}, and fallback {} not found",
-                override.value_or(fontface.monospace ? gli_conf_monofont : gli_conf_propfont),
-                fontface_to_name(fontface),
-                fallback));
+    throw FontNotFound(paths.notfound);
 }
 
-static std::vector<Font> make_substitution_fonts(FontFace fontface)
+static std::vector<std::string> substitution_font_paths(FontFace fontface)
 {
-    FT_Face face;
-    std::vector<Font> fonts;
-
-    auto files = gli_conf_glyph_substitution_files[fontface];
+    std::vector<std::string> files;
 
+    auto configured = gli_conf_glyph_substitution_files.find(fontface);
+    if (configured != gli_conf_glyph_substitution_files.end()) {
+        files = configured->second;
+    }
 
     for (const auto &path : {garglk::windatadir(), "."s}) {
         files.push_back(Format("{}/unifont.otf", path));
         files.push_back(Format("{}/unifont_upper.otf", path));
     }
 
+    return files;
+}
+
+static std::vector<Font> make_substitution_fonts(FontFace fontface, const std::vector<std::string> &files)
+{
+    FT_Face face;
+    std::vector<Font> fonts;
+
     for (const auto &file : files) {
-        if (FT_New_Face(ftlib, file.c_str(), 0, &face) == 0) {
+        if (open_face(file, face)) {
             try {
                 fonts.emplace_back(fontface, UniqueFace(face), file);
             } catch (const Font::LoadError &) {
@@ -374,9 +937,143 @@ static std::vector<Font> make_substitution_fonts(FontFace fontface)
     return fonts;
 }
 
+namespace {
+
+// The threads which garglk::parallel_for() shares work with. They are
+// started the first time they're needed and then wait for more, so a
+// call costs a wakeup rather than starting and joining threads.
+class WorkerPool {
+public:
+    // The pool is never destroyed: its threads wait on it until the
+    // process exits, and stopping and joining them from a static
+    // destructor can deadlock (e.g. on Windows, where threads have
+    // already been killed by then).
+    static WorkerPool &get() {
+        static auto *pool = new WorkerPool();
+        return *pool;
+    }
+
+    void run(std::size_t n, const std::function<void(std::size_t)> &task);
+
+private:
+    struct Job {
+        Job(std::size_t n_, const std::function<void(std::size_t)> &task_) :
+            n(n_),
+            task(task_),
+            errors(n_)
+        {
+        }
+
+        // Run tasks until none are left to claim.
+        void work() {
+            for (std::size_t i = next++; i < n; i = next++) {
+                try {
+                    task(i);
+                } catch (...) {
+                    errors[i] = std::current_exception();
+                }
+            }
+        }
+
+        std::size_t n;
+        const std::function<void(std::size_t)> &task;
+        std::vector<std::exception_ptr> errors;
+        std::atomic<std::size_t> next{0};
+        std::size_t workers = 0; // How many threads are in work().
+    };
+
+    WorkerPool();
+    void worker();
+    void retire(Job &job);
+
+    std::mutex m_mutex;
+    std::condition_variable m_queued;
+    std::condition_variable m_left;
+    std::deque<Job *> m_jobs;
+    std::size_t m_nthreads = 0;
+};
+
+}
+
+// One thread per core, less the calling thread. If the system refuses
+// to start one, the pool makes do with those it has (possibly none, in
+// which case callers run every task themselves).
+WorkerPool::WorkerPool()
+{
+    std::size_t cores = std::max(1U, std::thread::hardware_concurrency());
+
+    for (std::size_t i = 1; i < cores; i++) {
+        try {
+            std::thread(&WorkerPool::worker, this).detach();
+            m_nthreads++;
+        } catch (const std::system_error &) {
+            break;
+        }
+    }
+}
+
+void WorkerPool::worker()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    for (;;) {
+        m_queued.wait(lock, [this]() { return !m_jobs.empty(); });
+
+        Job *job = m_jobs.front();
+        job->workers++;
+        lock.unlock();
+        job->work();
+        lock.lock();
+        job->workers--;
+        retire(*job);
+        m_left.notify_all();
+    }
+}
+
+// Every task of "job" has been claimed, so stop handing it out.
+void WorkerPool::retire(Job &job)
+{
+    m_jobs.erase(std::remove(m_jobs.begin(), m_jobs.end(), &job), m_jobs.end());
+}
+
+// The calling thread works on its own job too, so a task may itself call
+// parallel_for() without waiting on a pool busy with its caller's job.
+void WorkerPool::run(std::size_t n, const std::function<void(std::size_t)> &task)
+{
+    Job job(n, task);
+
+    if (n > 1 && m_nthreads > 0) {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_jobs.push_back(&job);
+        for (std::size_t i = 1; i < n && i <= m_nthreads; i++) {
+            m_queued.notify_one();
+        }
+    }
+
+    job.work();
+
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        retire(job);
+        m_left.wait(lock, [&job]() { return job.workers == 0; });
+    }
+
+    for (const auto &error : job.errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+}
+
+void garglk::parallel_for(std::size_t n, const std::function<void(std::size_t)> &task)
+{
+    WorkerPool::get().run(n, task);
+}
+
 Font::Font(FontFace fontface, UniqueFace face, const std::string &fontpath) :
     m_face(std::move(face))
 {
+    static std::atomic<std::size_t> next_id{0};
     int err = 0;
     double aspect, size;
 
@@ -411,9 +1108,32 @@ Font::Font(FontFace fontface, UniqueFace face, const std::string &fontpath) :
     }
 
     m_kerned = FT_HAS_KERNING(m_face);
+    if (m_kerned) {
+        fill_kerntable();
+    }
+
+    // Ligatures are only used for proportional fonts, and only those
+    // the font actually has glyphs for.
+    if (!FT_IS_FIXED_WIDTH(m_face)) {
+        static const std::vector<std::pair<std::vector<glui32>, glui32>> ligatures = {
+            {{'f', 'f', 'i'}, UNI_LIG_FFI},
+            {{'f', 'f', 'l'}, UNI_LIG_FFL},
+            {{'f', 'f'}, UNI_LIG_FF},
+            {{'f', 'i'}, UNI_LIG_FI},
+            {{'f', 'l'}, UNI_LIG_FL},
+        };
+
+        for (const auto &[chars, ligature] : ligatures) {
+            if (FT_Get_Char_Index(m_face.get(), ligature) != 0) {
+                m_ligatures.add(chars, ligature);
+            }
+        }
+    }
 
     m_make_bold = fontface.bold && ((m_face->style_flags & FT_STYLE_FLAG_BOLD) == 0);
     m_make_oblique = fontface.italic && ((m_face->style_flags & FT_STYLE_FLAG_ITALIC) == 0);
+
+    m_id = next_id++;
 }
 
 void gli_initialize_fonts()
@@ -470,41 +1190,79 @@ void gli_initialize_fonts()
     }
     fontunload();
 
-    // Set up the Unicode fallback font.
-    auto faces = {FontFace::propr(), FontFace::propi(), FontFace::propb(), FontFace::propz(),
-                  FontFace::monor(), FontFace::monoi(), FontFace::monob(), FontFace::monoz()};
-    for (const auto &fontface : faces) {
-        glyph_substitution_fonts.insert({fontface, make_substitution_fonts(fontface)});
-    }
-
     // create oblique transform matrix
     ftmat.xx = 0x10000L;
     ftmat.yx = 0x00000L;
     ftmat.xy = 0x03000L;
     ftmat.yy = 0x10000L;
 
-    auto make_entry = [&problem_fonts](FontFace face, const std::string &fallback) {
-        return std::pair(face, make_font(face, fallback, problem_fonts));
+    const std::vector<std::pair<FontFace, std::string>> faces = {
+        {FontFace::monor(), "Gargoyle-Mono.ttf"},
+        {FontFace::monob(), "Gargoyle-Mono-Bold.ttf"},
+        {FontFace::monoi(), "Gargoyle-Mono-Italic.ttf"},
+        {FontFace::monoz(), "Gargoyle-Mono-Bold-Italic.ttf"},
+        {FontFace::propr(), "Gargoyle-Serif.ttf"},
+        {FontFace::propb(), "Gargoyle-Serif-Bold.ttf"},
+        {FontFace::propi(), "Gargoyle-Serif-Italic.ttf"},
+        {FontFace::propz(), "Gargoyle-Serif-Bold-Italic.ttf"},
     };
 
+    // Find all font files up front, then load the fonts (and the Unicode
+    // fallback fonts) in parallel: a task per face for each. The
+    // per-task times are summed to show what a serial load would cost.
+    std::vector<FontPaths> paths;
+    std::vector<std::vector<std::string>> substitution_paths;
+    for (const auto &[fontface, fallback] : faces) {
+        paths.push_back(font_paths(fontface, fallback));
+        substitution_paths.push_back(substitution_font_paths(fontface));
+    }
+
+    std::vector<std::optional<Font>> fonts(faces.size());
+    std::vector<std::vector<Font>> substitution_fonts(faces.size());
+    std::vector<std::vector<std::string>> task_problems(faces.size());
+    std::vector<std::chrono::duration<double, std::milli>> task_times(faces.size() * 2);
+
+    auto load_start = std::chrono::steady_clock::now();
+
     try {
-        gfont_table.insert(make_entry(FontFace::monor(), "Gargoyle-Mono.ttf"));
-        gfont_table.insert(make_entry(FontFace::monob(), "Gargoyle-Mono-Bold.ttf"));
-        gfont_table.insert(make_entry(FontFace::monoi(), "Gargoyle-Mono-Italic.ttf"));
-        gfont_table.insert(make_entry(FontFace::monoz(), "Gargoyle-Mono-Bold-Italic.ttf"));
-        gfont_table.insert(make_entry(FontFace::propr(), "Gargoyle-Serif.ttf"));
-        gfont_table.insert(make_entry(FontFace::propb(), "Gargoyle-Serif-Bold.ttf"));
-        gfont_table.insert(make_entry(FontFace::propi(), "Gargoyle-Serif-Italic.ttf"));
-        gfont_table.insert(make_entry(FontFace::propz(), "Gargoyle-Serif-Bold-Italic.ttf"));
-
-        const auto &entry = gfont_table.at(FontFace::monor()).getglyph('0');
-
-        gli_cellh = gli_leading;
-        gli_cellw = (entry.adv + GLI_SUBPIX - 1) / GLI_SUBPIX;
+        garglk::parallel_for(faces.size() * 2, [&](std::size_t i) {
+            auto start = std::chrono::steady_clock::now();
+            std::size_t face = i / 2;
+            const auto &fontface = faces[face].first;
+
+            if (i % 2 == 0) {
+                fonts[face].emplace(make_font(fontface, paths[face], task_problems[face]));
+            } else {
+                substitution_fonts[face] = make_substitution_fonts(fontface, substitution_paths[face]);
+            }
+
+            task_times[i] = std::chrono::steady_clock::now() - start;
+        });
+    } catch (const FontNotFound &e) {
+        garglk::winabort(e.what());
     } catch (const Font::LoadError &e) {
         garglk::winabort(Format("Unable to load font file \"{}\" ({}).", e.filename(), e.what()));
     }
 
+    font_load_stats.load = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - load_start).count();
+    for (const auto &time : task_times) {
+        font_load_stats.serial += time.count();
+    }
+
+    for (std::size_t i = 0; i < faces.size(); i++) {
+        const auto &fontface = faces[i].first;
+        gfont_table.emplace(fontface, std::move(*fonts[i]));
+        glyph_substitution_fonts.emplace(fontface, std::move(substitution_fonts[i]));
+        problem_fonts.insert(problem_fonts.end(), task_problems[i].begin(), task_problems[i].end());
+    }
+
+    const auto &entry = gfont_table.at(FontFace::monor()).getglyph('0');
+
+    gli_cellh = gli_leading;
+    gli_cellw = (entry.adv + GLI_SUBPIX - 1) / GLI_SUBPIX;
+
+    font_warmup.start();
+
     if (!problem_fonts.empty()) {
         auto msg = garglk::join(problem_fonts, "\n\n");
         garglk::winwarning("Font error", msg);
@@ -523,87 +1281,45 @@ void gli_draw_pixel(int x, int y, const Color &rgb)
     if (y < 0 || y >= gli_image_rgb.height()) {
         return;
     }
-    gli_image_rgb[y][x] = rgb;
+    gli_image_rgb[y][x] = garglk::FramebufferLayout::pixel(rgb);
 }
 
-static void draw_pixel_gamma(int x, int y, unsigned char alpha, const Color &rgb)
+// Composite a glyph bitmap with "bpp" coverage bytes per pixel (1 for
+// grayscale, 3 for LCD), clipping it to the framebuffer up front.
+static void draw_bitmap_blend(const Bitmap &b, int bpp, int x, int y, const Color &rgb)
 {
-    if (x < 0 || x >= gli_image_rgb.width()) {
-        return;
-    }
-    if (y < 0 || y >= gli_image_rgb.height()) {
+    int x0 = x + b.lsb;
+    int y0 = y - b.top;
+    int i0 = std::max(0, -x0);
+    int i1 = std::min(b.w / bpp, gli_image_rgb.width() - x0);
+    int k0 = std::max(0, -y0);
+    int k1 = std::min(b.h, gli_image_rgb.height() - y0);
+
+    if (i0 >= i1) {
         return;
     }
 
-    std::uint16_t invalf = GAMMA_MAX - (alpha * GAMMA_MAX / 255);
-    std::array<std::uint16_t, 3> bg = {
-        gammamap[gli_image_rgb[y][x][0]],
-        gammamap[gli_image_rgb[y][x][1]],
-        gammamap[gli_image_rgb[y][x][2]]
-    };
-    std::array<std::uint16_t, 3> fg = {
-        gammamap[rgb[0]],
-        gammamap[rgb[1]],
-        gammamap[rgb[2]]
-    };
+    GammaBlender<garglk::FramebufferLayout> blender(rgb, gammamap, gammainv);
 
-    gli_image_rgb[y][x] = Pixel<3>(gammainv[fg[0] + mulhigh(static_cast<int>(bg[0]) - fg[0], invalf)],
-                                   gammainv[fg[1] + mulhigh(static_cast<int>(bg[1]) - fg[1], invalf)],
-                                   gammainv[fg[2] + mulhigh(static_cast<int>(bg[2]) - fg[2], invalf)]);
-}
-
-static void draw_pixel_lcd_gamma(int x, int y, const unsigned char *alpha, const Color &rgb)
-{
-    if (x < 0 || x >= gli_image_rgb.width()) {
-        return;
-    }
-    if (y < 0 || y >= gli_image_rgb.height()) {
-        return;
+    for (int k = k0; k < k1; k++) {
+        unsigned char *dst = gli_image_rgb.data() + (y0 + k) * gli_image_rgb.stride() + (x0 + i0) * garglk::FramebufferLayout::size;
+        blender.blend(dst, b.data + k * b.pitch + i0 * bpp, i1 - i0, bpp == 3);
     }
-
-    std::array<std::uint16_t, 3> invalf = {
-        static_cast<std::uint16_t>(GAMMA_MAX - (alpha[0] * GAMMA_MAX / 255)),
-        static_cast<std::uint16_t>(GAMMA_MAX - (alpha[1] * GAMMA_MAX / 255)),
-        static_cast<std::uint16_t>(GAMMA_MAX - (alpha[2] * GAMMA_MAX / 255)),
-    };
-    std::array<std::uint16_t, 3> bg = {
-        gammamap[gli_image_rgb[y][x][0]],
-        gammamap[gli_image_rgb[y][x][1]],
-        gammamap[gli_image_rgb[y][x][2]]
-    };
-    std::array<std::uint16_t, 3> fg = {
-        gammamap[rgb[0]],
-        gammamap[rgb[1]],
-        gammamap[rgb[2]]
-    };
-
-    gli_image_rgb[y][x] = Pixel<3>(gammainv[fg[0] + mulhigh(static_cast<int>(bg[0]) - fg[0], invalf[0])],
-                                   gammainv[fg[1] + mulhigh(static_cast<int>(bg[1]) - fg[1], invalf[1])],
-                                   gammainv[fg[2] + mulhigh(static_cast<int>(bg[2]) - fg[2], invalf[2])]);
 }
 
 static void draw_bitmap_gamma(const Bitmap &b, int x, int y, const Color &rgb)
 {
-    for (int k = 0; k < b.h; k++) {
-        for (int i = 0; i < b.w; i++) {
-            auto c = b.data[k * b.pitch + i];
-            draw_pixel_gamma(x + b.lsb + i, y - b.top + k, c, rgb);
-        }
-    }
+    draw_bitmap_blend(b, 1, x, y, rgb);
 }
 
 static void draw_bitmap_lcd_gamma(const Bitmap &b, int x, int y, const Color &rgb)
 {
-    for (int k = 0; k < b.h; k++) {
-        for (int i = 0, j = 0; i < b.w; i += 3, j++) {
-            draw_pixel_lcd_gamma(x + b.lsb + j, y - b.top + k, b.data.data() + k * b.pitch + i, rgb);
-        }
-    }
+    draw_bitmap_blend(b, 3, x, y, rgb);
 }
 
 void gli_draw_clear(const Color &rgb)
 {
-    gli_image_rgb.fill(rgb);
+    gli_image_rgb.fill(garglk::FramebufferLayout::pixel(rgb));
 }
 
 void gli_draw_rect(int x0, int y0, int w, int h, const Color &rgb)
@@ -611,6 +1327,7 @@ void gli_draw_rect(int x0, int y0, int w, int h, const Color &rgb)
     int x1 = x0 + w;
     int y1 = y0 + h;
     int y;
+    auto pixel = garglk::FramebufferLayout::pixel(rgb);
 
     x0 = std::clamp(x0, 0, gli_image_rgb.width());
     y0 = std::clamp(y0, 0, gli_image_rgb.height());
@@ -618,162 +1335,290 @@ void gli_draw_rect(int x0, int y0, int w, int h, const Color &rgb)
     y1 = std::clamp(y1, 0, gli_image_rgb.height());
 
     for (y = y0; y < y1; y++) {
-        gli_image_rgb[y].fill(rgb, x0, x1);
+        gli_image_rgb[y].fill(pixel, x0, x1);
     }
 }
 
-int Font::charkern(glui32 c0, glui32 c1)
+int Font::kern_pair(FT_UInt g0, FT_UInt g1)
 {
     FT_Vector v;
-    int err;
-    int g0, g1;
 
+    int err = FT_Get_Kerning(m_face.get(), g0, g1, FT_KERNING_UNFITTED, &v);
+    if (err != 0) {
+        throw std::runtime_error(convert_ft_error(err, "FT_Get_Kerning"));
+    }
+
+    return (v.x * GLI_SUBPIX) / 64.0;
+}
+
+void Font::fill_kerntable()
+{
+    std::array<FT_UInt, KERN_TABLE_SIZE> gids;
+
+    for (glui32 i = 0; i < KERN_TABLE_SIZE; i++) {
+        gids[i] = FT_Get_Char_Index(m_face.get(), KERN_TABLE_FIRST + i);
+    }
+
+    std::vector<int> table(KERN_TABLE_SIZE * KERN_TABLE_SIZE, 0);
+
+    for (glui32 i = 0; i < KERN_TABLE_SIZE; i++) {
+        if (gids[i] == 0) {
+            continue;
+        }
+
+        for (glui32 j = 0; j < KERN_TABLE_SIZE; j++) {
+            if (gids[j] == 0) {
+                continue;
+            }
+
+            try {
+                table[i * KERN_TABLE_SIZE + j] = kern_pair(gids[i], gids[j]);
+            } catch (const std::runtime_error &) {
+                // Leave the table empty: charkern() will then look
+                // pairs up individually and report the error.
+                return;
+            }
+        }
+    }
+
+    m_kerntable = std::move(table);
+}
+
+int Font::charkern(glui32 c0, glui32 c1)
+{
     if (!m_kerned) {
         return 0;
     }
 
+    if (!m_kerntable.empty() &&
+        c0 >= KERN_TABLE_FIRST && c0 <= KERN_TABLE_LAST &&
+        c1 >= KERN_TABLE_FIRST && c1 <= KERN_TABLE_LAST) {
+
+        return m_kerntable[(c0 - KERN_TABLE_FIRST) * KERN_TABLE_SIZE + (c1 - KERN_TABLE_FIRST)];
+    }
+
     unsigned long long key = (static_cast<unsigned long long>(c0) << 32) | c1;
-    try {
-        return m_kerncache.at(key);
-    } catch (const std::out_of_range &) {
+    auto it = m_kerncache.find(key);
+    if (it != m_kerncache.end()) {
+        return it->second;
     }
 
-    g0 = FT_Get_Char_Index(m_face.get(), c0);
-    g1 = FT_Get_Char_Index(m_face.get(), c1);
+    FT_UInt g0 = FT_Get_Char_Index(m_face.get(), c0);
+    FT_UInt g1 = FT_Get_Char_Index(m_face.get(), c1);
 
     if (g0 == 0 || g1 == 0) {
         return 0;
     }
 
-    err = FT_Get_Kerning(m_face.get(), g0, g1, FT_KERNING_UNFITTED, &v);
-    if (err != 0) {
-        throw std::runtime_error(convert_ft_error(err, "FT_Get_Kerning"));
-    }
-
-    int value = (v.x * GLI_SUBPIX) / 64.0;
+    int value = kern_pair(g0, g1);
     m_kerncache.emplace(key, value);
 
     return value;
 }
 
-static const std::vector<std::pair<std::vector<glui32>, glui32>> ligatures = {
-    {{'f', 'f', 'i'}, UNI_LIG_FFI},
-    {{'f', 'f', 'l'}, UNI_LIG_FFL},
-    {{'f', 'f'}, UNI_LIG_FF},
-    {{'f', 'i'}, UNI_LIG_FI},
-    {{'f', 'l'}, UNI_LIG_FL},
-};
-
-static int gli_string_impl(int x, FontFace fontface, const glui32 *s, std::size_t n, int spw, const std::function<void(int, const std::array<Bitmap, GLI_SUBPIX> &)> &callback)
+// Return a FontEntry corresponding to the specific glyph, which may come
+// from a substitution font. If that glyph is unavailable, log a warning
+// and select a question mark instead. If a question mark can't be
+// loaded, abort with an error message. Lookups are cached.
+static const FontEntry &lookup_glyph(Font &f, FontFace fontface, glui32 c)
 {
-    auto &f = gfont_table.at(fontface);
-    bool dolig = !FT_IS_FIXED_WIDTH(f.face());
-    int prev = -1;
-    glui32 c;
+    auto &cache = f.lookups();
 
-    while (n > 0) {
-        auto it = ligatures.end();
-        if (dolig) {
-            it = std::find_if(ligatures.begin(), ligatures.end(), [s, n](const std::pair<std::vector<glui32>, glui32> &ligentry) {
-                const auto &ligature = ligentry.first;
-                if (ligature.size() > n) {
-                    return false;
-                }
+    const auto *cached = cache.find(c);
+    if (cached != nullptr) {
+        return *cached;
+    }
 
-                for (std::size_t i = 0; i < ligature.size(); i++) {
-                    if (s[i] != ligature[i]) {
-                        return false;
-                    }
-                }
+    try {
+        return cache.insert(c, f.getglyph(c), false);
+    } catch (const std::out_of_range &) {
+    }
 
-                return true;
-            });
+    for (auto &font : glyph_substitution_fonts[fontface]) {
+        try {
+            return cache.insert(c, font.getglyph(c), false);
+        } catch (const std::out_of_range &) {
         }
+    }
 
-        if (it != ligatures.end() && FT_Get_Char_Index(f.face().get(), it->second) != 0) {
-            c = it->second;
-            s += it->first.size();
-            n -= it->first.size();
-        } else {
-            c = *s++;
-            n--;
-        }
+    auto msg = Format("Unable to look up glyph {} for {}", c, fontface_to_name(fontface));
+    std::cerr << msg << std::endl;
+    try {
+        return cache.insert(c, f.getglyph(UNICODE_QUESTION_MARK), true);
+    } catch (const std::out_of_range &) {
+        garglk::winabort(Format("{}, and substituting '?' failed", msg));
+    }
+}
 
-        // Return a FontEntry corresponding to the specific glyph. If
-        // that glyph is unavailable, log a warning and select a
-        // question mark instead. If a question mark can't be loaded,
-        // abort with an error message. Lookups are cached.
-        auto glyph = [&f, &fontface](glui32 c) -> const FontEntry & {
-            static std::unordered_map<std::pair<FontFace, glui32>, FontEntry> fallback_cache;
+FontWarmup::~FontWarmup()
+{
+    if (m_thread.joinable()) {
+        m_stop = true;
+        m_thread.join();
+    }
+}
 
-            auto key = std::pair(fontface, c);
+void FontWarmup::start()
+{
+    m_running = true;
+    m_thread = std::thread([this]() {
+        run();
+    });
+}
 
-            auto it = fallback_cache.find(key);
-            if (it == fallback_cache.end()) {
-                try {
-                    it = fallback_cache.emplace(key, f.getglyph(c)).first;
-                } catch (const std::out_of_range &) {
-                    for (auto &font : glyph_substitution_fonts[fontface]) {
-                        try {
-                            it = fallback_cache.emplace(key, font.getglyph(c)).first;
-                            break;
-                        } catch (const std::out_of_range &) {
-                        }
-                    }
-                }
+std::unique_lock<std::mutex> FontWarmup::lock()
+{
+    if (!m_running.load(std::memory_order_acquire)) {
+        return {};
+    }
 
-                if (it == fallback_cache.end()) {
-                    auto msg = Format("Unable to look up glyph {} for {}", c, fontface_to_name(fontface));
-                    std::cerr << msg << std::endl;
-                    try {
-                        it = fallback_cache.emplace(key, f.getglyph(UNICODE_QUESTION_MARK)).first;
-                    } catch (const std::out_of_range &) {
-                        garglk::winabort(Format("{}, and substituting '?' failed", msg));
-                    }
-                }
+    return std::unique_lock<std::mutex>(m_mutex);
+}
+
+// Each bitmap is rendered under its own lock, so the main thread never
+// waits for more than a single glyph.
+void FontWarmup::run()
+{
+    auto start = std::chrono::steady_clock::now();
+    const std::array<FontFace, 8> faces = {
+        FontFace::propr(), FontFace::monor(), FontFace::propb(), FontFace::propi(),
+        FontFace::monob(), FontFace::monoi(), FontFace::propz(), FontFace::monoz(),
+    };
+
+    for (const auto &fontface : faces) {
+        auto &font = gfont_table.at(fontface);
+
+        for (glui32 c = 0x20; c < 0x7f; c++) {
+            for (int subpix = 0; subpix < GLI_SUBPIX && !m_stop; subpix++) {
+                std::lock_guard<std::mutex> guard(m_mutex);
+                lookup_glyph(font, fontface, c).bitmap(subpix);
+                font_load_stats.glyphs_warmed++;
             }
+        }
+    }
 
-            return it->second;
-        };
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        font_load_stats.warmup = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        font_load_stats.warmup_done = !m_stop;
+    }
+
+    m_running.store(false, std::memory_order_release);
+}
+
+garglk::FontLoadStats garglk::font_load_stats()
+{
+    auto lock = font_warmup.lock();
+    return ::font_load_stats;
+}
+
+// Lay out the string from "pen", calling "callback" with the pen
+// position of each glyph. If "offsets" is not null, the pen position of
+// the glyph which each character ended up in is appended to it. If
+// "stable" is true, stop before the first glyph which could still be
+// changed by characters following the string, i.e. which might become
+// part of a ligature. Returns the number of characters laid out.
+template <typename Callback>
+static std::size_t gli_string_walk(garglk::TextPen &pen, FontFace fontface, const glui32 *s, std::size_t n, int spw, bool stable, Callback callback, std::vector<int> *offsets = nullptr)
+{
+    auto &f = gfont_table.at(fontface);
+    std::size_t total = n;
+    glui32 c;
+
+    while (n > 0 && (!stable || n >= f.longest_ligature())) {
+        std::size_t consumed;
+        c = f.ligature(s, n, consumed);
+        s += consumed;
+        n -= consumed;
 
-        if (prev != -1) {
-            x += f.charkern(prev, c);
+        if (pen.prev != -1) {
+            pen.x += f.charkern(pen.prev, c);
         }
 
-        const auto &entry = glyph(c);
+        const auto &entry = lookup_glyph(f, fontface, c);
 
-        callback(x, entry.glyph);
+        callback(pen.x, entry);
+
+        if (offsets != nullptr) {
+            offsets->insert(offsets->end(), consumed, pen.x);
+        }
 
         if (spw >= 0 && c == ' ') {
-            x += spw;
+            pen.x += spw;
         } else {
-            x += entry.adv;
+            pen.x += entry.adv;
         }
 
-        prev = c;
+        pen.prev = c;
     }
 
-    return x;
+    return total - n;
+}
+
+template <typename Callback>
+static int gli_string_impl(int x, FontFace fontface, const glui32 *s, std::size_t n, int spw, Callback callback, std::vector<int> *offsets = nullptr)
+{
+    auto lock = font_warmup.lock();
+    garglk::TextPen pen{x, -1};
+
+    gli_string_walk(pen, fontface, s, n, spw, false, callback, offsets);
+
+    return pen.x;
 }
 
 int gli_draw_string_uni(int x, int y, FontFace face, const Color &rgb,
-                        const glui32 *text, int len, int spacewidth)
+                        const glui32 *text, int len, int spacewidth, rect_t *ink)
 {
-    return gli_string_impl(x, face, text, len, spacewidth, [&y, &rgb](int x, const std::array<Bitmap, GLI_SUBPIX> &glyphs) {
+    return gli_string_impl(x, face, text, len, spacewidth, [&y, &rgb, ink](int x, const FontEntry &entry) {
         int px = x / GLI_SUBPIX;
         int sx = x % GLI_SUBPIX;
+        const Bitmap &b = entry.bitmap(sx);
+
+        if (ink != nullptr && b.w > 0 && b.h > 0) {
+            ink->x0 = std::min(ink->x0, px + b.lsb);
+            ink->y0 = std::min(ink->y0, y - b.top);
+            ink->x1 = std::max(ink->x1, px + b.lsb + b.w / (gli_conf_lcd ? 3 : 1));
+            ink->y1 = std::max(ink->y1, y - b.top + b.h);
+        }
 
         if (gli_conf_lcd) {
-            draw_bitmap_lcd_gamma(glyphs[sx], px, y, rgb);
+            draw_bitmap_lcd_gamma(b, px, y, rgb);
         } else {
-            draw_bitmap_gamma(glyphs[sx], px, y, rgb);
+            draw_bitmap_gamma(b, px, y, rgb);
         }
     });
 }
 
+const garglk::TextRun &gli_string_measure_uni(FontFace face, const glui32 *text, int len, int spacewidth)
+{
+    std::size_t n = std::max(len, 0);
+
+    const auto *cached = text_run_cache.find(face, spacewidth, text, n);
+    if (cached != nullptr) {
+        return *cached;
+    }
+
+    garglk::TextRun run;
+    run.offsets.reserve(n);
+    run.width = gli_string_impl(0, face, text, n, spacewidth, [](int, const FontEntry &) {}, &run.offsets);
+
+    return text_run_cache.insert(face, spacewidth, text, n, std::move(run));
+}
+
+int gli_string_advance_uni(FontFace face, garglk::TextPen &pen, const glui32 *text, int len, int spacewidth, bool stable)
+{
+    auto lock = font_warmup.lock();
+
+    return gli_string_walk(pen, face, text, std::max(len, 0), spacewidth, stable, [](int, const FontEntry &) {});
+}
+
 int gli_string_width_uni(FontFace face, const glui32 *text, int len, int spacewidth)
 {
-    return gli_string_impl(0, face, text, len, spacewidth, [](int, const std::array<Bitmap, GLI_SUBPIX> &) {});
+    if (len <= 0) {
+        return 0;
+    }
+
+    return gli_string_measure_uni(face, text, len, spacewidth).width;
 }
 
 void gli_draw_caret(int x, int y)
@@ -797,6 +1642,171 @@ void gli_draw_caret(int x, int y)
     }
 }
 
+// Alpha blend "n" RGBA pixels at "src" onto the pixels at "dst", which
+// are laid out according to "Layout", i.e. for each channel
+//
+//     dst = mul255(src, alpha) + mul255(dst, 255 - alpha)
+//
+// Like glyph blending, this is done a chunk of pixels at a time: the
+// color and alpha of the source are first spread out to line up with
+// the destination's channels, and the blending itself is vectorized
+// where possible. The vector code computes mul255() in 16-bit lanes,
+// using the identity x / 255 == (x + 1 + (x >> 8)) >> 8, which holds
+// for every x that mul255() can produce, so results are identical to
+// the scalar code. A padding byte is blended as an opaque 0xff, which
+// leaves it at 0xff.
+template <typename Layout>
+static void blend_picture_span(unsigned char *dst, const unsigned char *src, int n)
+{
+    constexpr int CHUNK_PIXELS = 64;
+    std::array<unsigned char, CHUNK_PIXELS * Layout::size> color;
+    std::array<unsigned char, CHUNK_PIXELS * Layout::size> alpha;
+
+    while (n > 0) {
+        int count = std::min(n, CHUNK_PIXELS);
+        int channels = count * Layout::size;
+
+        for (int i = 0; i < count; i++) {
+            unsigned char *c = &color[i * Layout::size];
+            unsigned char *a = &alpha[i * Layout::size];
+            c[Layout::r] = src[i * 4 + 0];
+            c[Layout::g] = src[i * 4 + 1];
+            c[Layout::b] = src[i * 4 + 2];
+            a[Layout::r] = src[i * 4 + 3];
+            a[Layout::g] = src[i * 4 + 3];
+            a[Layout::b] = src[i * 4 + 3];
+            if constexpr (Layout::size == 4) {
+                c[Layout::x] = 0xff;
+                a[Layout::x] = 0xff;
+            }
+        }
+
+        int i = 0;
+
+#if defined(GARGLK_SIMD_AVX2)
+        {
+            const __m256i zero = _mm256_setzero_si256();
+            const __m256i one = _mm256_set1_epi16(1);
+            const __m256i full = _mm256_set1_epi16(255);
+            const __m256i half = _mm256_set1_epi16(127);
+
+            auto mul255v = [&](__m256i a, __m256i b) {
+                __m256i x = _mm256_add_epi16(_mm256_mullo_epi16(a, b), half);
+                return _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(x, one), _mm256_srli_epi16(x, 8)), 8);
+            };
+
+            for (; i + 32 <= channels; i += 32) {
+                __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&color[i]));
+                __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&alpha[i]));
+                __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&dst[i]));
+
+                __m256i alo = _mm256_unpacklo_epi8(a, zero);
+                __m256i ahi = _mm256_unpackhi_epi8(a, zero);
+                __m256i lo = _mm256_add_epi16(mul255v(_mm256_unpacklo_epi8(c, zero), alo),
+                                              mul255v(_mm256_unpacklo_epi8(d, zero), _mm256_sub_epi16(full, alo)));
+                __m256i hi = _mm256_add_epi16(mul255v(_mm256_unpackhi_epi8(c, zero), ahi),
+                                              mul255v(_mm256_unpackhi_epi8(d, zero), _mm256_sub_epi16(full, ahi)));
+
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(&dst[i]), _mm256_packus_epi16(lo, hi));
+            }
+        }
+#elif defined(GARGLK_SIMD_SSE2)
+        {
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i one = _mm_set1_epi16(1);
+            const __m128i full = _mm_set1_epi16(255);
+            const __m128i half = _mm_set1_epi16(127);
+
+            auto mul255v = [&](__m128i a, __m128i b) {
+                __m128i x = _mm_add_epi16(_mm_mullo_epi16(a, b), half);
+                return _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(x, one), _mm_srli_epi16(x, 8)), 8);
+            };
+
+            for (; i + 16 <= channels; i += 16) {
+                __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&color[i]));
+                __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&alpha[i]));
+                __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&dst[i]));
+
+                __m128i alo = _mm_unpacklo_epi8(a, zero);
+                __m128i ahi = _mm_unpackhi_epi8(a, zero);
+                __m128i lo = _mm_add_epi16(mul255v(_mm_unpacklo_epi8(c, zero), alo),
+                                           mul255v(_mm_unpacklo_epi8(d, zero), _mm_sub_epi16(full, alo)));
+                __m128i hi = _mm_add_epi16(mul255v(_mm_unpackhi_epi8(c, zero), ahi),
+                                           mul255v(_mm_unpackhi_epi8(d, zero), _mm_sub_epi16(full, ahi)));
+
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(&dst[i]), _mm_packus_epi16(lo, hi));
+            }
+        }
+#elif defined(GARGLK_SIMD_NEON)
+        {
+            const uint16x8_t one = vdupq_n_u16(1);
+            const uint16x8_t half = vdupq_n_u16(127);
+            const uint8x8_t full = vdup_n_u8(255);
+
+            auto mul255v = [&](uint8x8_t a, uint8x8_t b) {
+                uint16x8_t x = vaddq_u16(vmull_u8(a, b), half);
+                return vshrq_n_u16(vaddq_u16(vaddq_u16(x, one), vshrq_n_u16(x, 8)), 8);
+            };
+
+            for (; i + 16 <= channels; i += 16) {
+                uint8x16_t c = vld1q_u8(&color[i]);
+                uint8x16_t a = vld1q_u8(&alpha[i]);
+                uint8x16_t d = vld1q_u8(&dst[i]);
+
+                uint16x8_t lo = vaddq_u16(mul255v(vget_low_u8(c), vget_low_u8(a)),
+                                          mul255v(vget_low_u8(d), vsub_u8(full, vget_low_u8(a))));
+                uint16x8_t hi = vaddq_u16(mul255v(vget_high_u8(c), vget_high_u8(a)),
+                                          mul255v(vget_high_u8(d), vsub_u8(full, vget_high_u8(a))));
+
+                vst1q_u8(&dst[i], vcombine_u8(vmovn_u16(lo), vmovn_u16(hi)));
+            }
+        }
+#endif
+
+        for (; i < channels; i++) {
+            unsigned char sc = mul255(color[i], alpha[i]);
+            dst[i] = sc + mul255(dst[i], 255 - alpha[i]);
+        }
+
+        dst += channels;
+        src += count * 4;
+        n -= count;
+    }
+}
+
+template <typename Layout>
+static void blend_picture(Canvas<Layout::size> &dst, int dx, int dy, const picture_t *pic, int sx, int sy, int w, int h)
+{
+    for (int y = 0; y < h; y++) {
+        unsigned char *drow = dst.data() + (dy + y) * dst.stride() + dx * Layout::size;
+        const unsigned char *srow = pic->rgba.data() + (sy + y) * pic->rgba.stride() + sx * 4;
+
+        switch (pic->rowalpha[sy + y]) {
+        case picture_t::RowAlpha::Transparent:
+            break;
+        case picture_t::RowAlpha::Opaque:
+            for (int x = 0; x < w; x++) {
+                unsigned char *d = &drow[x * Layout::size];
+                d[Layout::r] = srow[x * 4 + 0];
+                d[Layout::g] = srow[x * 4 + 1];
+                d[Layout::b] = srow[x * 4 + 2];
+                if constexpr (Layout::size == 4) {
+                    d[Layout::x] = 0xff;
+                }
+            }
+            break;
+        case picture_t::RowAlpha::Blend:
+            blend_picture_span<Layout>(drow, srow, w);
+            break;
+        }
+    }
+}
+
+void gli_blend_picture(Canvas<3> &dst, int dx, int dy, const picture_t *pic, int sx, int sy, int w, int h)
+{
+    blend_picture<garglk::LayoutRGB888>(dst, dx, dy, pic, sx, sy, w, h);
+}
+
 void gli_draw_picture(const picture_t *pic, int x0, int y0, int dx0, int dy0, int dx1, int dy1)
 {
     int x1, y1, sx0, sy0, sx1, sy1;
@@ -834,17 +1844,5 @@ void gli_draw_picture(const picture_t *pic, int x0, int y0, int dx0, int dy0, in
     w = sx1 - sx0;
     h = sy1 - sy0;
 
-    for (int y = 0; y < h; y++) {
-        for (int x = 0; x < w; x++) {
-            auto existing = gli_image_rgb[y + y0][x + x0];
-            unsigned char sa = pic->rgba[y + sy0][x + sx0][3];
-            unsigned char na = 255 - sa;
-            unsigned char sr = mul255(pic->rgba[y + sy0][x + sx0][0], sa);
-            unsigned char sg = mul255(pic->rgba[y + sy0][x + sx0][1], sa);
-            unsigned char sb = mul255(pic->rgba[y + sy0][x + sx0][2], sa);
-            gli_image_rgb[y + y0][x + x0] = Pixel<3>(sr + mul255(existing[0], na),
-                                                     sg + mul255(existing[1], na),
-                                                     sb + mul255(existing[2], na));
-        }
-    }
+    blend_picture<garglk::FramebufferLayout>(gli_image_rgb, x0, y0, pic, sx0, sy0, w, h);
 }
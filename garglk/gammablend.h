@@ -0,0 +1,223 @@
+// Copyright (C) 2026 by Chris Spiegel.
+//
+// This file is part of Gargoyle.
+//
+// Gargoyle is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// Gargoyle is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Gargoyle; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+#ifndef GARGLK_GAMMABLEND_H
+#define GARGLK_GAMMABLEND_H
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
+#include "garglk.h"
+#include "simd.h"
+
+#define GAMMA_BITS 11
+#define GAMMA_MAX ((1 << GAMMA_BITS) - 1)
+
+#define mulhigh(a, b) ((static_cast<int>(a) * (b) + (1 << (GAMMA_BITS - 1)) - 1) / GAMMA_MAX)
+
+// Gamma tables: each 8-bit color value mapped to a GAMMA_BITS-bit linear
+// value, and back.
+using GammaMap = std::array<std::uint16_t, 256>;
+using GammaInv = std::array<unsigned char, 1 << GAMMA_BITS>;
+
+// Glyphs are composited in gamma-corrected space: for each channel the
+// result is
+//
+//     gammainv[fg + mulhigh(gammamap[dst] - fg, GAMMA_MAX - alpha * GAMMA_MAX / 255)]
+//
+// where fg is the gamma-mapped text color. Rather than doing this one
+// pixel at a time, each clipped row of a glyph is handled as a span of
+// channels: the table lookups are done in a scalar pass, and the
+// arithmetic in between is vectorized where possible.
+//
+// The vector code does both divisions in single precision. Every
+// dividend is an integer whose magnitude is below 2^23 and every
+// quotient is below 2^12, so the correctly rounded float quotient is
+// never close enough to the next integer to truncate differently than
+// integer division would. The results are bit-identical to the scalar
+// code.
+//
+// This is in an anonymous namespace because which vector code it uses
+// depends on the flags its includer is compiled with: the tests build
+// it several ways, and each has to get its own copy.
+namespace {
+
+// Blends text of one color into pixels of the given layout, using the
+// gamma tables "gammamap" (color to linear) and "gammainv" (linear to
+// color), which must outlive it.
+template <typename Layout>
+class GammaBlender {
+public:
+    GammaBlender(const Color &rgb, const GammaMap &gammamap, const GammaInv &gammainv) :
+        m_gammamap(gammamap),
+        m_gammainv(gammainv),
+        m_fg{gammamap[rgb[0]], gammamap[rgb[1]], gammamap[rgb[2]]}
+    {
+    }
+
+    // Blend "n" framebuffer pixels at "dst". If "lcd" is true, "alpha"
+    // holds one coverage value per channel, otherwise one per pixel.
+    void blend(unsigned char *dst, const unsigned char *alpha, int n, bool lcd) {
+        while (n > 0) {
+            int count = std::min(n, CHUNK_PIXELS);
+            int channels = count * 3;
+
+            for (int i = 0; i < count; i++) {
+                const unsigned char *pixel = &dst[i * Layout::size];
+                m_bg[i * 3 + 0] = m_gammamap[pixel[Layout::r]];
+                m_bg[i * 3 + 1] = m_gammamap[pixel[Layout::g]];
+                m_bg[i * 3 + 2] = m_gammamap[pixel[Layout::b]];
+            }
+
+            if (lcd) {
+                for (int i = 0; i < channels; i++) {
+                    m_alpha[i] = alpha[i];
+                }
+            } else {
+                for (int i = 0; i < count; i++) {
+                    m_alpha[i * 3 + 0] = alpha[i];
+                    m_alpha[i * 3 + 1] = alpha[i];
+                    m_alpha[i * 3 + 2] = alpha[i];
+                }
+            }
+
+            blend_channels(channels);
+
+            for (int i = 0; i < count; i++) {
+                unsigned char *pixel = &dst[i * Layout::size];
+                pixel[Layout::r] = m_gammainv[m_bg[i * 3 + 0]];
+                pixel[Layout::g] = m_gammainv[m_bg[i * 3 + 1]];
+                pixel[Layout::b] = m_gammainv[m_bg[i * 3 + 2]];
+            }
+
+            dst += count * Layout::size;
+            alpha += lcd ? channels : count;
+            n -= count;
+        }
+    }
+
+private:
+    // A multiple of 8 pixels, so that a chunk is made up of whole
+    // 24-channel (AVX2) or 12-channel (SSE2/NEON) blocks.
+    static constexpr int CHUNK_PIXELS = 96;
+
+    const GammaMap &m_gammamap;
+    const GammaInv &m_gammainv;
+    std::array<int, 3> m_fg;
+    std::array<std::int32_t, CHUNK_PIXELS * 3> m_bg;
+    std::array<std::int32_t, CHUNK_PIXELS * 3> m_alpha;
+
+    // Replace the gamma-mapped background values in m_bg with indexes
+    // into gammainv.
+    void blend_channels(int n) {
+        int i = 0;
+
+#if defined(GARGLK_SIMD_AVX2)
+        // Three registers cover eight pixels, with the color channels
+        // rotating through the lanes.
+        const __m256i fgi[3] = {
+            _mm256_setr_epi32(m_fg[0], m_fg[1], m_fg[2], m_fg[0], m_fg[1], m_fg[2], m_fg[0], m_fg[1]),
+            _mm256_setr_epi32(m_fg[2], m_fg[0], m_fg[1], m_fg[2], m_fg[0], m_fg[1], m_fg[2], m_fg[0]),
+            _mm256_setr_epi32(m_fg[1], m_fg[2], m_fg[0], m_fg[1], m_fg[2], m_fg[0], m_fg[1], m_fg[2]),
+        };
+        const __m256 max = _mm256_set1_ps(GAMMA_MAX);
+        const __m256 full = _mm256_set1_ps(255);
+        const __m256 half = _mm256_set1_ps((1 << (GAMMA_BITS - 1)) - 1);
+
+        for (; i + 24 <= n; i += 24) {
+            for (int j = 0; j < 3; j++) {
+                auto *bgp = reinterpret_cast<__m256i *>(&m_bg[i + j * 8]);
+                const auto *alphap = reinterpret_cast<const __m256i *>(&m_alpha[i + j * 8]);
+
+                __m256 alpha = _mm256_cvtepi32_ps(_mm256_loadu_si256(alphap));
+                __m256 scaled = _mm256_cvtepi32_ps(_mm256_cvttps_epi32(_mm256_div_ps(_mm256_mul_ps(alpha, max), full)));
+                __m256 invalf = _mm256_sub_ps(max, scaled);
+                __m256 diff = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_loadu_si256(bgp), fgi[j]));
+                __m256 t = _mm256_add_ps(_mm256_mul_ps(diff, invalf), half);
+                __m256i q = _mm256_cvttps_epi32(_mm256_div_ps(t, max));
+                _mm256_storeu_si256(bgp, _mm256_add_epi32(q, fgi[j]));
+            }
+        }
+#elif defined(GARGLK_SIMD_SSE2)
+        // Three registers cover four pixels, with the color channels
+        // rotating through the lanes.
+        const __m128i fgi[3] = {
+            _mm_setr_epi32(m_fg[0], m_fg[1], m_fg[2], m_fg[0]),
+            _mm_setr_epi32(m_fg[1], m_fg[2], m_fg[0], m_fg[1]),
+            _mm_setr_epi32(m_fg[2], m_fg[0], m_fg[1], m_fg[2]),
+        };
+        const __m128 max = _mm_set1_ps(GAMMA_MAX);
+        const __m128 full = _mm_set1_ps(255);
+        const __m128 half = _mm_set1_ps((1 << (GAMMA_BITS - 1)) - 1);
+
+        for (; i + 12 <= n; i += 12) {
+            for (int j = 0; j < 3; j++) {
+                auto *bgp = reinterpret_cast<__m128i *>(&m_bg[i + j * 4]);
+                const auto *alphap = reinterpret_cast<const __m128i *>(&m_alpha[i + j * 4]);
+
+                __m128 alpha = _mm_cvtepi32_ps(_mm_loadu_si128(alphap));
+                __m128 scaled = _mm_cvtepi32_ps(_mm_cvttps_epi32(_mm_div_ps(_mm_mul_ps(alpha, max), full)));
+                __m128 invalf = _mm_sub_ps(max, scaled);
+                __m128 diff = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_loadu_si128(bgp), fgi[j]));
+                __m128 t = _mm_add_ps(_mm_mul_ps(diff, invalf), half);
+                __m128i q = _mm_cvttps_epi32(_mm_div_ps(t, max));
+                _mm_storeu_si128(bgp, _mm_add_epi32(q, fgi[j]));
+            }
+        }
+#elif defined(GARGLK_SIMD_NEON)
+        const std::array<std::array<std::int32_t, 4>, 3> fgs = {{
+            {m_fg[0], m_fg[1], m_fg[2], m_fg[0]},
+            {m_fg[1], m_fg[2], m_fg[0], m_fg[1]},
+            {m_fg[2], m_fg[0], m_fg[1], m_fg[2]},
+        }};
+        const int32x4_t fgi[3] = {
+            vld1q_s32(fgs[0].data()),
+            vld1q_s32(fgs[1].data()),
+            vld1q_s32(fgs[2].data()),
+        };
+        const float32x4_t max = vdupq_n_f32(GAMMA_MAX);
+        const float32x4_t full = vdupq_n_f32(255);
+        const float32x4_t half = vdupq_n_f32((1 << (GAMMA_BITS - 1)) - 1);
+
+        for (; i + 12 <= n; i += 12) {
+            for (int j = 0; j < 3; j++) {
+                std::int32_t *bgp = &m_bg[i + j * 4];
+
+                float32x4_t alpha = vcvtq_f32_s32(vld1q_s32(&m_alpha[i + j * 4]));
+                float32x4_t scaled = vcvtq_f32_s32(vcvtq_s32_f32(vdivq_f32(vmulq_f32(alpha, max), full)));
+                float32x4_t invalf = vsubq_f32(max, scaled);
+                float32x4_t diff = vcvtq_f32_s32(vsubq_s32(vld1q_s32(bgp), fgi[j]));
+                float32x4_t t = vaddq_f32(vmulq_f32(diff, invalf), half);
+                int32x4_t q = vcvtq_s32_f32(vdivq_f32(t, max));
+                vst1q_s32(bgp, vaddq_s32(q, fgi[j]));
+            }
+        }
+#endif
+
+        for (; i < n; i++) {
+            int fg = m_fg[i % 3];
+            int invalf = GAMMA_MAX - (m_alpha[i] * GAMMA_MAX / 255);
+            m_bg[i] = fg + mulhigh(m_bg[i] - fg, invalf);
+        }
+    }
+};
+
+}
+
+#endif
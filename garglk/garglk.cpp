@@ -20,6 +20,7 @@
 #include <filesystem>
 #include <fstream>
 #include <ios>
+#include <limits>
 #include <map>
 #include <stdexcept>
 #include <string>
@@ -63,6 +64,7 @@ void garglk_set_story_title(const char *title)
 int garglk_tads_os_banner_size(winid_t win)
 {
     window_textbuffer_t *dwin = win->winbuffer();
+    win_textbuffer_reflow_history(dwin, std::numeric_limits<int>::max());
     int size = dwin->scrollmax;
     if (dwin->numchars != 0) {
         size++;
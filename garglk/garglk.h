@@ -186,6 +186,94 @@ std::optional<std::string> winlegacythemedir();
 std::optional<std::string> winappdir();
 bool winisfullscreen();
 
+// Usage counters for the various internal caches (glyphs, pictures,
+// etc.), for diagnostic purposes.
+struct CacheStats {
+    std::size_t hits = 0;
+    std::size_t misses = 0;
+    std::size_t evictions = 0;
+    std::size_t entries = 0;
+    std::size_t missing = 0; // Entries recording that a lookup failed.
+    std::size_t bytes = 0;
+    std::size_t capacity = 0;
+};
+
+CacheStats glyph_cache_stats();
+CacheStats text_run_cache_stats();
+CacheStats glyph_lookup_cache_stats();
+CacheStats line_cache_stats();
+CacheStats picture_cache_stats();
+
+// Cold start timings for fonts, in milliseconds. The faces are loaded
+// in parallel: "load" is how long that took, and "serial" is the sum of
+// the time spent on each face, i.e. roughly what loading them one after
+// another would have cost. Glyphs for printable ASCII are then rendered
+// in the background, which took "warmup".
+struct FontLoadStats {
+    double load = 0;
+    double serial = 0;
+    double warmup = 0;
+    std::size_t glyphs_warmed = 0;
+    bool warmup_done = false;
+};
+
+FontLoadStats font_load_stats();
+
+// Run tasks 0 through n-1 on up to one thread per core (the calling
+// thread included), returning when all have finished. The other threads
+// belong to a pool which is started on first use and kept, so a call
+// costs waking them rather than starting them. If the system refuses to
+// start a thread, the tasks are shared among the threads which did
+// start, or run on the calling thread alone. Tasks may themselves call
+// parallel_for(). If any task throws, the exception from the
+// lowest-numbered one is rethrown.
+void parallel_for(std::size_t n, const std::function<void(std::size_t)> &task);
+
+// The layout of a run of text in a single font: its total advance, and
+// for each character, the pen position of the glyph it is drawn as (the
+// characters making up a ligature all share the ligature's position).
+// Both are in subpixels, relative to the start of the run.
+struct TextRun {
+    int width = 0;
+    std::vector<int> offsets;
+};
+
+// How far measuring a string has got, so that it can be carried on
+// later, e.g. as more text is appended: the pen position in subpixels,
+// and the last character (or ligature) measured, for kerning, or -1.
+struct TextPen {
+    int x = 0;
+    int prev = -1;
+};
+
+// A trie of the ligatures a font supports, used to find the longest
+// ligature at the start of a string in a single forward pass.
+class LigatureTrie {
+public:
+    void add(const std::vector<glui32> &chars, glui32 ligature);
+
+    // Return the ligature matching the longest prefix of the "n"
+    // characters at "s", storing its length in "len". If there is no
+    // match, return the first character with a length of 1.
+    glui32 match(const glui32 *s, std::size_t n, std::size_t &len) const;
+
+    // The length of the longest sequence which forms a ligature (1 if
+    // there are none): a match against at least this many characters
+    // can't be changed by characters following them.
+    std::size_t longest() const {
+        return m_longest;
+    }
+
+private:
+    struct Node {
+        std::vector<std::pair<glui32, std::size_t>> children;
+        glui32 ligature = 0;
+    };
+
+    std::vector<Node> m_nodes{Node()};
+    std::size_t m_longest = 1;
+};
+
 namespace theme {
 void init();
 bool set(std::string name);
@@ -312,10 +400,33 @@ public:
         return PixelView<N>(&m_row[x * N]);
     }
 
+    // Short spans are filled a pixel at a time. Longer spans of pixels
+    // whose channels are all the same are a memset; otherwise the first
+    // pixel is written and then repeatedly doubled, so a span of n
+    // pixels takes about log2(n) copies.
     void fill(const Pixel<N> &pixel, int start, int end) {
         auto data = pixel.data();
-        for (int i = start; i < end; i++) {
-            std::memcpy(&m_row[i * N], data, N);
+
+        if (end - start <= 8) {
+            for (int i = start; i < end; i++) {
+                std::memcpy(&m_row[i * N], data, N);
+            }
+            return;
+        }
+
+        unsigned char *dst = &m_row[start * N];
+        std::size_t total = static_cast<std::size_t>(end - start) * N;
+
+        if (std::all_of(data, data + N, [data](unsigned char c) { return c == data[0]; })) {
+            std::memset(dst, data[0], total);
+            return;
+        }
+
+        std::memcpy(dst, data, N);
+        for (std::size_t done = N; done < total;) {
+            std::size_t n = std::min(done, total - done);
+            std::memcpy(dst + done, dst, n);
+            done += n;
         }
     }
 
@@ -384,8 +495,8 @@ public:
     }
 
     void fill(const Pixel<N> &pixel) {
-        for (int i = 0; i < m_width * m_height; i++) {
-            std::memcpy(&m_pixels[i * N], pixel.data(), N);
+        if (!m_pixels.empty()) {
+            Row<N>(m_pixels.data()).fill(pixel, 0, m_width * m_height);
         }
     }
 
@@ -430,6 +541,60 @@ private:
 
 using Color = Pixel<3>;
 
+namespace garglk {
+
+// Byte layouts for canvases holding opaque colors: the size of each
+// pixel and the offset of each color channel within it.
+struct LayoutRGB888 {
+    static constexpr std::size_t size = 3;
+    static constexpr std::size_t r = 0;
+    static constexpr std::size_t g = 1;
+    static constexpr std::size_t b = 2;
+
+    static Pixel<size> pixel(const Color &color) {
+        return color;
+    }
+};
+
+// A native-endian 32-bit 0xffRRGGBB word per pixel, which is what Qt
+// calls Format_RGB32. The padding byte is always written as 0xff, so
+// the same data is valid ARGB32_Premultiplied.
+struct LayoutXRGB8888 {
+    static constexpr std::size_t size = 4;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    static constexpr std::size_t x = 0;
+    static constexpr std::size_t r = 1;
+    static constexpr std::size_t g = 2;
+    static constexpr std::size_t b = 3;
+
+    static Pixel<size> pixel(const Color &color) {
+        return Pixel<size>(0xff, color[0], color[1], color[2]);
+    }
+#else
+    static constexpr std::size_t b = 0;
+    static constexpr std::size_t g = 1;
+    static constexpr std::size_t r = 2;
+    static constexpr std::size_t x = 3;
+
+    static Pixel<size> pixel(const Color &color) {
+        return Pixel<size>(color[2], color[1], color[0], 0xff);
+    }
+#endif
+};
+
+// The layout of the framebuffer (gli_image_rgb). RGB888 is the default
+// and is what the Cocoa frontend expects; the Qt frontend can instead
+// use XRGB8888, which it can paint without converting every pixel.
+#ifdef GARGLK_CONFIG_XRGB_FRAMEBUFFER
+using FramebufferLayout = LayoutXRGB8888;
+#else
+using FramebufferLayout = LayoutRGB888;
+#endif
+
+}
+
+using Framebuffer = Canvas<garglk::FramebufferLayout::size>;
+
 Color gli_parse_color(const std::string &str);
 
 class Bleeps {
@@ -518,19 +683,22 @@ struct rect_t {
 };
 
 struct picture_t {
-    picture_t(unsigned long id_, Canvas<4> rgba_, bool scaled_) :
-        id(id_),
-        rgba(std::move(rgba_)),
-        w(rgba.width()),
-        h(rgba.height()),
-        scaled(scaled_)
-    {
-    }
+    picture_t(unsigned long id_, Canvas<4> rgba_, bool scaled_);
+
+    // How each row has to be drawn: rows which are entirely opaque are
+    // copied and rows which are entirely transparent are skipped, with
+    // only the rest being alpha blended.
+    enum class RowAlpha : unsigned char {
+        Blend,
+        Opaque,
+        Transparent,
+    };
 
     unsigned long id;
     Canvas<4> rgba;
     int w, h;
     bool scaled;
+    std::vector<RowAlpha> rowalpha;
 };
 
 struct style_t {
@@ -555,7 +723,7 @@ struct style_t {
 
 using Styles = std::array<style_t, style_NUMSTYLES>;
 
-extern Canvas<3> gli_image_rgb;
+extern Framebuffer gli_image_rgb;
 
 //
 // Config globals
@@ -699,6 +867,14 @@ enum class Scaler {
 };
 extern Scaler gli_conf_scaler;
 
+enum class ImageFilter {
+    Classic,
+    Box,
+    Bilinear,
+    Lanczos,
+};
+extern ImageFilter gli_conf_image_filter;
+
 enum class GameInfoShow {
     Never,
     Once,
@@ -707,6 +883,10 @@ enum class GameInfoShow {
 extern GARGLK_API GameInfoShow gli_conf_game_info;
 
 extern std::unordered_map<FontFace, std::vector<std::string>> gli_conf_glyph_substitution_files;
+extern std::size_t gli_conf_glyph_cache_size;
+extern std::size_t gli_conf_line_cache_size;
+extern std::size_t gli_conf_picture_cache_size;
+extern int gli_conf_scrollback;
 
 // XXX See issue #730.
 extern bool gli_conf_redraw_hack;
@@ -910,11 +1090,12 @@ struct window_pair_t {
     bool wborder;            // winMethod_Border, NoBorder
 };
 
-// One line of the grid window.
+// One line of a text grid window. Only the columns from "dirtybeg" up to
+// "dirtyend" have changed since the line was last drawn.
 struct tgline_t {
-    bool dirty = false;
-    std::array<glui32, 256> chars;
-    std::array<attr_t, 256> attrs;
+    int dirtybeg = 0, dirtyend = 0;
+    std::vector<glui32> chars;
+    std::vector<attr_t> attrs;
 };
 
 struct window_textgrid_t {
@@ -933,7 +1114,10 @@ struct window_textgrid_t {
     window_t *owner;
 
     int width = 0, height = 0;
-    std::array<tgline_t, 256> lines;
+    // Grown to the largest size the window has had, and never shrunk, so
+    // that line input started before the window got smaller still has
+    // somewhere to go.
+    std::vector<tgline_t> lines;
 
     int curx = 0, cury = 0; // the window cursor position
 
@@ -950,27 +1134,158 @@ struct window_textgrid_t {
     Styles styles = gli_gstyles;
 };
 
+// A run of characters in a text buffer line which share attributes,
+// from "start" up to the start of the next run or the end of the line.
+struct tbrun_t {
+    int start;
+    attr_t attr;
+};
+
+// One line of a text buffer window. Only as many characters as the line
+// holds are stored, and attributes are stored once per run instead of
+// once per character, since most lines have only one or two runs.
 struct tbline_t {
-    tbline_t() {
-        chars.fill(' ');
-    }
     int len = 0;
     std::optional<int> flow_break_pos;
     bool newline = false, dirty = false, repaint = false;
     std::shared_ptr<picture_t> lpic, rpic;
     glui32 lhyper = 0, rhyper = 0;
     int lm = 0, rm = 0;
-    std::array<glui32, TBLINELEN> chars;
-    std::array<attr_t, TBLINELEN> attrs;
+    std::vector<glui32> chars;
+    std::vector<tbrun_t> runs;
+
+    void store(const glui32 *chars_, const attr_t *attrs_, int len_);
+    void clear_text();
+    [[nodiscard]] const attr_t &attr(int i) const;
+};
+
+// A paragraph of text buffer history as it was printed, rather than as
+// it was laid out into lines, so that it can be laid out again at a new
+// width. "chars" includes the newline which ends the paragraph.
+struct tbpara_t {
+    struct Picture {
+        int pos; // the character the picture was placed before
+        glui32 align;
+        std::shared_ptr<picture_t> pic;
+        glui32 hyper;
+    };
+
+    std::vector<glui32> chars;
+    std::vector<tbrun_t> runs;
+    std::vector<Picture> pictures;
+    std::vector<int> flow_breaks;
+
+    // At most how many lines after this paragraph can still be beside a
+    // margin picture. Layout can start afresh only where this is 0.
+    int margin_lines = 0;
+};
+
+// Tracks the width of the line being written to in a text buffer
+// window, so that deciding whether to wrap doesn't require measuring
+// the whole line again each time a character is appended to it.
+struct tbwrap_t {
+    int seen = -1;      // the line's length when last updated, or -1
+    int run = 0;        // start of the attribute run being measured
+    int runswidth = 0;  // width of the runs before "run"
+    int pos = 0;        // how far "pen" has measured
+    garglk::TextPen pen;
+    int space = 0;      // the last space after the first character, or 0
+};
+
+// The lines of a text buffer window, newest first: line 0 is the one
+// currently being written to. The most recent SCROLLBACK lines are
+// stored in a ring, so that scrolling only moves the start of the ring
+// instead of copying every line in the scrollback down a slot. Lines
+// which scroll out of the ring are gathered into pages, which are
+// compressed, and only decompressed again when they're looked at.
+class TextBufferLines {
+public:
+    TextBufferLines() : m_lines(SCROLLBACK) {
+    }
+
+    tbline_t &operator[](std::size_t i) {
+        return i < m_lines.size() ? m_lines[index(i)] : old_line(i - m_lines.size(), true);
+    }
+
+    const tbline_t &operator[](std::size_t i) const {
+        return i < m_lines.size() ? m_lines[index(i)] : old_line(i - m_lines.size(), false);
+    }
+
+    // Line "i", for updating only whether it needs drawing ("dirty" and
+    // "repaint"). That isn't kept when a page of old lines is packed, so
+    // unlike operator[], this doesn't mark the line's page as changed.
+    tbline_t &view(std::size_t i) {
+        return i < m_lines.size() ? m_lines[index(i)] : old_line(i - m_lines.size(), false);
+    }
+
+    [[nodiscard]] std::size_t size() const {
+        return m_lines.size() + m_open.size() + m_paged;
+    }
+
+    // Add empty lines at the old end until there are at least "n".
+    void grow(std::size_t n);
+
+    // Move every line "n" places towards the old end. The "n" oldest
+    // lines of the ring wrap around to become lines 0 through n - 1,
+    // and it is up to the caller to clear them. If any of them are
+    // among the first "used" lines, they are kept as old lines first.
+    // Scrolling by more than the ring holds scrolls the whole ring.
+    void scroll(std::size_t n, std::size_t used);
+
+    // Throw away the oldest pages, as long as at least "n" lines are
+    // left.
+    void trim(std::size_t n);
+
+    // Throw away every line older than the ring.
+    void clear_old();
+
+private:
+    static constexpr std::size_t PageLines = 256;
+    static constexpr std::size_t ResidentPages = 4;
+
+    struct Page {
+        std::size_t count = 0;
+        std::vector<unsigned char> data;
+        std::size_t rawsize = 0;
+
+        // Pictures can't be compressed along with the text, so the
+        // margin pictures of each line are kept here, if there are any.
+        std::vector<std::pair<std::shared_ptr<picture_t>, std::shared_ptr<picture_t>>> pictures;
+
+        // The decompressed lines, while the page is resident.
+        std::vector<tbline_t> lines;
+        bool dirty = false;
+    };
+
+    std::vector<tbline_t> m_lines;
+    std::size_t m_head = 0;
+
+    // Old lines which don't yet fill a page, newest first, followed by
+    // the pages, also newest first. Every page but the oldest is full.
+    mutable std::deque<tbline_t> m_open;
+    mutable std::deque<Page> m_pages;
+    std::size_t m_paged = 0;
+
+    // Pages which are currently decompressed, most recently used first.
+    mutable std::vector<Page *> m_resident;
+
+    [[nodiscard]] std::size_t index(std::size_t i) const {
+        i += m_head;
+        return i < m_lines.size() ? i : i - m_lines.size();
+    }
+
+    tbline_t &old_line(std::size_t i, bool write) const;
+    void load(Page &page) const;
+    void unload(Page &page) const;
+    void forget(Page &page) const;
+    static void pack(Page &page);
 };
 
 struct window_textbuffer_t {
     explicit window_textbuffer_t(window_t *owner_) :
         owner(owner_)
     {
-        lines.resize(scrollback);
-        chars = lines[0].chars.data();
-        attrs = lines[0].attrs.data();
+        chars.fill(' ');
     }
 
     ~window_textbuffer_t() {
@@ -986,12 +1301,14 @@ struct window_textbuffer_t {
     int spaced = 0;
     int dashed = 0;
 
-    std::vector<tbline_t> lines;
-    int scrollback = SCROLLBACK;
+    TextBufferLines lines;
 
-    int numchars = 0; // number of chars in last line: lines[0]
-    glui32 *chars;    // alias to lines[0].chars
-    attr_t *attrs;    // alias to lines[0].attrs
+    // The last line, lines[0], is edited here, and only stored into
+    // lines[0] when it's needed (on scrolling, redrawing, etc.).
+    int numchars = 0; // number of chars in last line
+    std::array<glui32, TBLINELEN> chars;
+    std::array<attr_t, TBLINELEN> attrs;
+    tbwrap_t wrap;
 
     // adjust margins temporarily for images
     int ladjw = 0;
@@ -999,6 +1316,11 @@ struct window_textbuffer_t {
     int radjw = 0;
     int radjn = 0;
 
+    // History older than the lines above which hasn't been laid out
+    // since the window was last resized, oldest first. It's laid out
+    // when it's scrolled into view.
+    std::vector<tbpara_t> paragraphs;
+
     // Command history.
     std::deque<std::vector<glui32>> history;
     std::deque<std::vector<glui32>>::iterator history_it = history.begin();
@@ -1007,6 +1329,11 @@ struct window_textbuffer_t {
     int lastseen = 0;
     int scrollpos = 0;
     int scrollmax = 0;
+    int scrollback = gli_conf_scrollback; // most lines to keep, or 0 for all
+
+    // The tallest picture ever put in the window, which bounds how far
+    // above the visible lines a picture can be and still be seen.
+    int tallest_picture = 0;
 
     // for line input
     void *inbuf = nullptr; // unsigned char* for latin1, glui32* for unicode
@@ -1033,7 +1360,8 @@ struct window_graphics_t {
 
     window_t *owner;
     Color bgnd;
-    bool dirty = false;
+    bool dirty = false;         // the whole window needs to be redrawn
+    std::vector<rect_t> damage; // otherwise, just these parts of it
     int w = 0, h = 0;
     Canvas<3> rgb;
 };
@@ -1066,6 +1394,7 @@ extern void win_pair_click(window_pair_t *dwin, int x, int y);
 extern void win_textgrid_rearrange(window_t *win, rect_t *box);
 extern void win_textgrid_redraw(window_t *win);
 extern void win_textgrid_putchar_uni(window_t *win, glui32 ch);
+extern void win_textgrid_putbuffer_uni(window_t *win, const glui32 *buf, std::size_t len);
 extern bool win_textgrid_unputchar_uni(window_t *win, glui32 ch);
 extern void win_textgrid_clear(window_t *win);
 extern void win_textgrid_move_cursor(window_t *win, int xpos, int ypos);
@@ -1079,6 +1408,8 @@ extern void gcmd_grid_accept_readline(window_t *win, glui32 arg);
 extern void win_textbuffer_rearrange(window_t *win, rect_t *box);
 extern void win_textbuffer_redraw(window_t *win);
 extern void win_textbuffer_putchar_uni(window_t *win, glui32 ch);
+extern void win_textbuffer_putbuffer_uni(window_t *win, const glui32 *buf, std::size_t len);
+extern void win_textbuffer_reflow_history(window_textbuffer_t *dwin, int lines);
 extern bool win_textbuffer_unputchar_uni(window_t *win, glui32 ch);
 extern void win_textbuffer_clear(window_t *win);
 extern void win_textbuffer_init_line(window_t *win, char *buf, int maxlen, int initlen);
@@ -1100,17 +1431,20 @@ extern window_t *gli_window_iterate_treeorder(window_t *win);
 extern void gli_window_rearrange(window_t *win, rect_t *box);
 extern void gli_window_redraw(window_t *win);
 extern void gli_window_put_char_uni(window_t *win, glui32 ch);
+extern void gli_window_put_buffer_uni(window_t *win, const glui32 *buf, std::size_t len);
 extern bool gli_window_unput_char_uni(window_t *win, glui32 ch);
 extern bool gli_window_check_terminator(glui32 ch);
 extern void gli_window_refocus(window_t *win);
 
 extern void gli_windows_redraw();
+extern void gli_windows_redraw_damaged(const std::vector<rect_t> &damage);
 extern void gli_windows_size_change(int w, int h, bool post_arrange_event);
 extern void gli_windows_unechostream(stream_t *str);
 
 extern void gli_window_click(window_t *win, int x, int y);
 
 void gli_redraw_rect(int x0, int y0, int x1, int y1);
+void gli_repaint_text(int x0, int y0, int x1, int y1);
 
 void gli_input_handle_key(glui32 key);
 void gli_input_handle_key_paste(glui32 key);
@@ -1134,9 +1468,19 @@ void gli_initialize_fonts();
 void gli_draw_pixel(int x, int y, const Color &rgb);
 void gli_draw_clear(const Color &rgb);
 void gli_draw_rect(int x, int y, int w, int h, const Color &rgb);
-int gli_draw_string_uni(int x, int y, FontFace face, const Color &rgb, const glui32 *text, int len, int spacewidth);
+// If "ink" isn't null, it's grown to cover every glyph drawn, including
+// any parts of glyphs which fall outside the framebuffer.
+int gli_draw_string_uni(int x, int y, FontFace face, const Color &rgb, const glui32 *text, int len, int spacewidth, rect_t *ink = nullptr);
 int gli_string_width_uni(FontFace face, const glui32 *text, int len, int spacewidth);
+// The returned run is cached, and only valid until the next call.
+const garglk::TextRun &gli_string_measure_uni(FontFace face, const glui32 *text, int len, int spacewidth);
+// Measure "text" starting from "pen", advancing it. If "stable" is true,
+// stop before any characters which might be measured differently once
+// more text follows them (because they could start a ligature). Returns
+// the number of characters measured.
+int gli_string_advance_uni(FontFace face, garglk::TextPen &pen, const glui32 *text, int len, int spacewidth, bool stable);
 void gli_draw_caret(int x, int y);
+void gli_blend_picture(Canvas<3> &dst, int dx, int dy, const picture_t *pic, int sx, int sy, int w, int h);
 void gli_draw_picture(const picture_t *pic, int x0, int y0, int dx0, int dy0, int dx1, int dy1);
 
 extern void gli_select(event_t *event, bool polled);
@@ -1160,8 +1504,12 @@ bool giblorb_copy_resource(glui32 usage, glui32 resnum, glui32 &type, std::vecto
 
 std::shared_ptr<picture_t> gli_picture_load(unsigned long id);
 void gli_picture_store(const std::shared_ptr<picture_t> &pic);
-std::shared_ptr<picture_t> gli_picture_retrieve(unsigned long id, bool scaled);
+std::shared_ptr<picture_t> gli_picture_retrieve(unsigned long id);
+std::shared_ptr<picture_t> gli_picture_retrieve_scaled(unsigned long id, int w, int h);
 std::shared_ptr<picture_t> gli_picture_scale(const picture_t *src, int newcols, int newrows);
+// Resize "src" with "filter" alone: unlike gli_picture_scale(), this
+// neither applies the hqx/xBRZ scalers nor caches the result.
+Canvas<4> gli_picture_resample(const picture_t *src, int newcols, int newrows, ImageFilter filter);
 void gli_piclist_increment();
 void gli_piclist_decrement();
 
@@ -1173,6 +1521,7 @@ bool win_graphics_draw_picture(std::shared_ptr<picture_t> pic, window_graphics_t
   glsi32 xpos, glsi32 ypos, glui32 imagewidth, glui32 imageheight);
 void win_graphics_erase_rect(window_graphics_t *dwin, bool whole, glsi32 x0, glsi32 y0, glui32 width, glui32 height);
 void win_graphics_fill_rect(window_graphics_t *dwin, glui32 color, glsi32 x0, glsi32 y0, glui32 width, glui32 height);
+void win_graphics_draw_pixels(window_graphics_t *dwin, const void *pixels, glui32 format, glui32 stride, const glui32 *palette, glsi32 x0, glsi32 y0, glui32 width, glui32 height, glui32 scale);
 void win_graphics_set_background_color(window_graphics_t *dwin, glui32 color);
 
 bool win_textbuffer_draw_picture(std::shared_ptr<picture_t> pic, window_textbuffer_t *dwin, glui32 window_width, glui32 align, glui32 width, glui32 height, glui32 maxwidth);
@@ -20,6 +20,8 @@
 #include <algorithm>
 #include <array>
 #include <functional>
+#include <iterator>
+#include <list>
 #include <memory>
 #include <stdexcept>
 #include <unordered_map>
@@ -32,31 +34,173 @@
 
 namespace {
 
-struct PicturePair {
-    std::shared_ptr<picture_t> picture;
-    std::shared_ptr<picture_t> scaled;
+std::unordered_map<unsigned long, std::shared_ptr<picture_t>> picstore;
+
+int gli_piclist_refcount = 0; // count references to loaded pictures
+
+// Scaled copies of pictures in the picture store, several per picture
+// if it has been drawn at several sizes. Entries are keyed on the size
+// and on the scaler which produced them, and are discarded least
+// recently used first once the cache is over its budget. The most
+// recently used entry is always kept, however large it is, so that a
+// picture being drawn repeatedly at one size is only scaled once.
+class ScaledPictureCache {
+public:
+    struct Key {
+        unsigned long id;
+        int w;
+        int h;
+        Scaler scaler;
+
+        bool operator==(const Key &other) const {
+            return id == other.id && w == other.w && h == other.h && scaler == other.scaler;
+        }
+    };
+
+    std::shared_ptr<picture_t> find(const Key &key);
+    void insert(const Key &key, std::shared_ptr<picture_t> pic);
+    void erase(unsigned long id);
+    void clear();
+    garglk::CacheStats stats() const;
+
+private:
+    struct KeyHash {
+        std::size_t operator()(const Key &key) const {
+            auto seed = hash_combine(0, std::hash<unsigned long>()(key.id));
+            seed = hash_combine(seed, std::hash<int>()(key.w));
+            seed = hash_combine(seed, std::hash<int>()(key.h));
+            return hash_combine(seed, static_cast<std::size_t>(key.scaler));
+        }
+    };
+
+    struct Entry {
+        Key key;
+        std::shared_ptr<picture_t> pic;
+
+        std::size_t size() const {
+            return sizeof(Entry) + sizeof(picture_t) + pic->rgba.size() + pic->rowalpha.size();
+        }
+    };
+
+    void remove(std::list<Entry>::iterator it);
+
+    // Most recently used first.
+    std::list<Entry> m_lru;
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> m_entries;
+    std::size_t m_bytes = 0;
+    garglk::CacheStats m_stats;
 };
 
-std::unordered_map<unsigned long, PicturePair> picstore;
+ScaledPictureCache scaled_cache;
 
-int gli_piclist_refcount = 0; // count references to loaded pictures
+std::shared_ptr<picture_t> ScaledPictureCache::find(const Key &key)
+{
+    auto it = m_entries.find(key);
+    if (it == m_entries.end()) {
+        m_stats.misses++;
+        return nullptr;
+    }
+
+    m_stats.hits++;
+    m_lru.splice(m_lru.begin(), m_lru, it->second);
+
+    return it->second->pic;
+}
+
+void ScaledPictureCache::insert(const Key &key, std::shared_ptr<picture_t> pic)
+{
+    auto old = m_entries.find(key);
+    if (old != m_entries.end()) {
+        remove(old->second);
+    }
+
+    m_lru.push_front(Entry{key, std::move(pic)});
+    m_entries[key] = m_lru.begin();
+    m_bytes += m_lru.front().size();
+
+    while (m_bytes > gli_conf_picture_cache_size && m_lru.size() > 1) {
+        remove(std::prev(m_lru.end()));
+        m_stats.evictions++;
+    }
+}
+
+// Discard every scaled copy of one picture.
+void ScaledPictureCache::erase(unsigned long id)
+{
+    for (auto it = m_lru.begin(); it != m_lru.end();) {
+        auto next = std::next(it);
+        if (it->key.id == id) {
+            remove(it);
+        }
+        it = next;
+    }
+}
+
+void ScaledPictureCache::clear()
+{
+    m_lru.clear();
+    m_entries.clear();
+    m_bytes = 0;
+}
+
+void ScaledPictureCache::remove(std::list<Entry>::iterator it)
+{
+    m_bytes -= it->size();
+    m_entries.erase(it->key);
+    m_lru.erase(it);
+}
+
+garglk::CacheStats ScaledPictureCache::stats() const
+{
+    auto stats = m_stats;
+    stats.entries = m_lru.size();
+    stats.bytes = m_bytes;
+    stats.capacity = gli_conf_picture_cache_size;
+
+    return stats;
+}
 
 void gli_picture_store_original(const std::shared_ptr<picture_t> &pic)
 {
-    picstore[pic->id] = PicturePair{pic, nullptr};
+    picstore[pic->id] = pic;
+    scaled_cache.erase(pic->id);
 }
 
 void gli_picture_store_scaled(const std::shared_ptr<picture_t> &pic)
 {
-    try {
-        auto &picpair = picstore.at(pic->id);
-        picpair.scaled = pic;
-    } catch (const std::out_of_range &) {
+    if (picstore.find(pic->id) != picstore.end()) {
+        scaled_cache.insert(ScaledPictureCache::Key{pic->id, pic->w, pic->h, gli_conf_scaler}, pic);
     }
 }
 
 }
 
+picture_t::picture_t(unsigned long id_, Canvas<4> rgba_, bool scaled_) :
+    id(id_),
+    rgba(std::move(rgba_)),
+    w(rgba.width()),
+    h(rgba.height()),
+    scaled(scaled_),
+    rowalpha(h, RowAlpha::Blend)
+{
+    for (int y = 0; y < h; y++) {
+        const unsigned char *row = rgba.data() + y * rgba.stride();
+        bool opaque = true;
+        bool transparent = true;
+
+        for (int x = 0; x < w && (opaque || transparent); x++) {
+            opaque = opaque && row[x * 4 + 3] == 255;
+            transparent = transparent && row[x * 4 + 3] == 0;
+        }
+
+        if (opaque) {
+            rowalpha[y] = RowAlpha::Opaque;
+        } else if (transparent) {
+            rowalpha[y] = RowAlpha::Transparent;
+        }
+    }
+}
+
 void gli_piclist_increment()
 {
     gli_piclist_refcount++;
@@ -66,6 +210,7 @@ void gli_piclist_decrement()
 {
     if (gli_piclist_refcount > 0 && --gli_piclist_refcount == 0) {
         picstore.clear();
+        scaled_cache.clear();
     }
 }
 
@@ -82,21 +227,27 @@ void gli_picture_store(const std::shared_ptr<picture_t> &pic)
     }
 }
 
-std::shared_ptr<picture_t> gli_picture_retrieve(unsigned long id, bool scaled)
+std::shared_ptr<picture_t> gli_picture_retrieve(unsigned long id)
 {
-    try {
-        const auto &picpair = picstore.at(id);
-        return scaled ? picpair.scaled : picpair.picture;
-    } catch (const std::out_of_range &) {
-        return nullptr;
-    }
+    auto it = picstore.find(id);
+    return it != picstore.end() ? it->second : nullptr;
+}
+
+std::shared_ptr<picture_t> gli_picture_retrieve_scaled(unsigned long id, int w, int h)
+{
+    return scaled_cache.find(ScaledPictureCache::Key{id, w, h, gli_conf_scaler});
+}
+
+garglk::CacheStats garglk::picture_cache_stats()
+{
+    return scaled_cache.stats();
 }
 
 std::shared_ptr<picture_t> gli_picture_load(unsigned long id)
 {
     glui32 chunktype;
 
-    auto pic = gli_picture_retrieve(id, false);
+    auto pic = gli_picture_retrieve(id);
     if (pic) {
         return pic;
     }
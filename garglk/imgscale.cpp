@@ -17,42 +17,34 @@
 // along with Gargoyle; if not, write to the Free Software
 // Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 
-// Image scaling, based on pnmscale.c...
+// Image scaling: pnmscale's area averaging, and a separable resampler
+// with a choice of filters.
 
 #include <algorithm>
+#include <array>
 #include <cmath>
 #include <cstdint>
+#include <functional>
 #include <memory>
 #include <utility>
 #include <vector>
 
 #include "glk.h"
 #include "garglk.h"
+#include "simd.h"
 
 #ifdef GARGLK_CONFIG_SCALERS
 #include "hqx.h"
 #include "xbrz.h"
 #endif
 
+static Canvas<4> scale_classic(const picture_t *src, int newcols, int newrows);
+static Canvas<4> scale_separable(const picture_t *src, int newcols, int newrows, ImageFilter filter);
+
 std::shared_ptr<picture_t> gli_picture_scale(const picture_t *src, int newcols, int newrows)
 {
-    // pnmscale.c - read a portable anymap and scale it
-    //
-    // Copyright (C) 1989, 1991 by Jef Poskanzer.
-    //
-    // Permission to use, copy, modify, and distribute this software and its
-    // documentation for any purpose and without fee is hereby granted, provided
-    // that the above copyright notice appear in all copies and that both that
-    // copyright notice and this permission notice appear in supporting
-    // documentation.  This software is provided "as is" without express or
-    // implied warranty.
-
-    constexpr int SCALE = 4096;
-    constexpr int HALFSCALE = 2048;
-    constexpr long maxval = 255;
-
-    auto dst = gli_picture_retrieve(src->id, true);
-    if (dst != nullptr && dst->w == newcols && dst->h == newrows) {
+    auto dst = gli_picture_retrieve_scaled(src->id, newcols, newrows);
+    if (dst != nullptr) {
         return dst;
     }
 
@@ -113,6 +105,44 @@ std::shared_ptr<picture_t> gli_picture_scale(const picture_t *src, int newcols,
     }
 #endif
 
+    auto rgba = gli_picture_resample(src, newcols, newrows, gli_conf_image_filter);
+
+    dst = std::make_shared<picture_t>(src->id, std::move(rgba), true);
+
+    gli_picture_store(dst);
+
+    return dst;
+}
+
+Canvas<4> gli_picture_resample(const picture_t *src, int newcols, int newrows, ImageFilter filter)
+{
+    if (filter == ImageFilter::Classic) {
+        return scale_classic(src, newcols, newrows);
+    }
+
+    return scale_separable(src, newcols, newrows, filter);
+}
+
+// Scale "src" to "newcols" by "newrows" the way pnmscale does: each
+// destination pixel is the average of the source area it covers, in
+// fixed point.
+static Canvas<4> scale_classic(const picture_t *src, int newcols, int newrows)
+{
+    // pnmscale.c - read a portable anymap and scale it
+    //
+    // Copyright (C) 1989, 1991 by Jef Poskanzer.
+    //
+    // Permission to use, copy, modify, and distribute this software and its
+    // documentation for any purpose and without fee is hereby granted, provided
+    // that the above copyright notice appear in all copies and that both that
+    // copyright notice and this permission notice appear in supporting
+    // documentation.  This software is provided "as is" without express or
+    // implied warranty.
+
+    constexpr int SCALE = 4096;
+    constexpr int HALFSCALE = 2048;
+    constexpr long maxval = 255;
+
     int row, col;
 
     int rowsread;
@@ -295,9 +325,257 @@ std::shared_ptr<picture_t> gli_picture_scale(const picture_t *src, int newcols,
         }
     }
 
-    dst = std::make_shared<picture_t>(src->id, rgba, true);
+    return rgba;
+}
 
-    gli_picture_store(dst);
+// The separable resampler scales horizontally, then vertically, with
+// the chosen filter. It works on premultiplied alpha in floating point,
+// so transparent pixels don't bleed their color into their neighbors.
+// The accumulation loops are vectorized where possible; the scalar
+// fallbacks perform the same operations in the same order, so results
+// don't depend on which one runs. Rows are split across threads by
+// garglk::parallel_for().
+
+namespace {
+
+// How the source pixels along one axis contribute to each destination
+// pixel: destination pixel "i" is the sum of source pixels first[i]
+// through first[i] + count[i] - 1, weighted by weights[i * taps] on.
+struct Contributions {
+    int taps = 0;
+    std::vector<int> first;
+    std::vector<int> count;
+    std::vector<float> weights;
+};
+
+// M_PI isn't portable; see zbleep.cpp.
+constexpr double pi = 3.14159265358979323846;
+
+double sinc(double x)
+{
+    if (x == 0) {
+        return 1;
+    }
 
-    return dst;
+    x *= pi;
+
+    return std::sin(x) / x;
+}
+
+Contributions contributions(int srcsize, int dstsize, ImageFilter filter)
+{
+    double scale = static_cast<double>(dstsize) / srcsize;
+    // When shrinking, filters are widened to cover the source pixels
+    // which fall within each destination pixel.
+    double stretch = std::max(1.0, 1.0 / scale);
+    double support = stretch * (filter == ImageFilter::Lanczos ? 3 : 1);
+
+    Contributions result;
+    result.taps = static_cast<int>(std::ceil(support * 2)) + 2;
+    result.first.resize(dstsize);
+    result.count.resize(dstsize);
+    result.weights.resize(static_cast<std::size_t>(dstsize) * result.taps);
+
+    std::vector<double> weights;
+
+    for (int i = 0; i < dstsize; i++) {
+        int lo, hi;
+        weights.clear();
+
+        if (filter == ImageFilter::Box) {
+            // Each source pixel is weighted by how much of it the
+            // destination pixel covers.
+            double x0 = i / scale;
+            double x1 = (i + 1) / scale;
+            lo = std::max(static_cast<int>(std::floor(x0)), 0);
+            hi = std::min(static_cast<int>(std::ceil(x1)), srcsize);
+            for (int j = lo; j < hi; j++) {
+                weights.push_back(std::min<double>(j + 1, x1) - std::max<double>(j, x0));
+            }
+        } else {
+            double center = (i + 0.5) / scale - 0.5;
+            lo = std::max(static_cast<int>(std::ceil(center - support)), 0);
+            hi = std::min(static_cast<int>(std::floor(center + support)) + 1, srcsize);
+            for (int j = lo; j < hi; j++) {
+                double x = (j - center) / stretch;
+                if (filter == ImageFilter::Bilinear) {
+                    weights.push_back(std::max(0.0, 1 - std::abs(x)));
+                } else {
+                    weights.push_back(std::abs(x) < 3 ? sinc(x) * sinc(x / 3) : 0);
+                }
+            }
+        }
+
+        double total = 0;
+        for (auto weight : weights) {
+            total += weight;
+        }
+
+        // Only possible if the filter lands entirely between pixels
+        // (which it can't) or outside the image, but just in case,
+        // fall back to the nearest pixel.
+        if (weights.empty() || total == 0) {
+            lo = std::clamp(static_cast<int>((i + 0.5) / scale), 0, srcsize - 1);
+            weights.assign(1, 1);
+            total = 1;
+        }
+
+        result.first[i] = lo;
+        result.count[i] = static_cast<int>(weights.size());
+        for (std::size_t k = 0; k < weights.size(); k++) {
+            result.weights[i * result.taps + k] = static_cast<float>(weights[k] / total);
+        }
+    }
+
+    return result;
+}
+
+// Store the weighted sum of "n" premultiplied RGBA pixels at "src" in
+// the single pixel at "dst".
+void weighted_sum(float *dst, const float *src, const float *weights, int n)
+{
+#if defined(GARGLK_SIMD_SSE2)
+    __m128 acc = _mm_setzero_ps();
+    for (int k = 0; k < n; k++) {
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(weights[k]), _mm_loadu_ps(src + k * 4)));
+    }
+    _mm_storeu_ps(dst, acc);
+#elif defined(GARGLK_SIMD_NEON)
+    float32x4_t acc = vdupq_n_f32(0);
+    for (int k = 0; k < n; k++) {
+        acc = vaddq_f32(acc, vmulq_f32(vdupq_n_f32(weights[k]), vld1q_f32(src + k * 4)));
+    }
+    vst1q_f32(dst, acc);
+#else
+    std::array<float, 4> acc{};
+    for (int k = 0; k < n; k++) {
+        for (int c = 0; c < 4; c++) {
+            acc[c] = acc[c] + weights[k] * src[k * 4 + c];
+        }
+    }
+    std::copy(acc.begin(), acc.end(), dst);
+#endif
+}
+
+// Add "weight" times each of the "n" floats at "src" to those at "dst".
+void add_weighted(float *dst, const float *src, float weight, std::size_t n)
+{
+    std::size_t i = 0;
+
+#if defined(GARGLK_SIMD_AVX2)
+    const __m256 w8 = _mm256_set1_ps(weight);
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_loadu_ps(dst + i), _mm256_mul_ps(w8, _mm256_loadu_ps(src + i))));
+    }
+#endif
+#if defined(GARGLK_SIMD_SSE2)
+    const __m128 w4 = _mm_set1_ps(weight);
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_mul_ps(w4, _mm_loadu_ps(src + i))));
+    }
+#elif defined(GARGLK_SIMD_NEON)
+    const float32x4_t w4 = vdupq_n_f32(weight);
+    for (; i + 4 <= n; i += 4) {
+        vst1q_f32(dst + i, vaddq_f32(vld1q_f32(dst + i), vmulq_f32(w4, vld1q_f32(src + i))));
+    }
+#endif
+
+    for (; i < n; i++) {
+        dst[i] = dst[i] + weight * src[i];
+    }
+}
+
+unsigned char to_channel(float value)
+{
+    return static_cast<unsigned char>(std::clamp(value, 0.0F, 255.0F) + 0.5F);
+}
+
+// Run task(start, end) over rows 0 through n-1, in chunks of about
+// "work" units (roughly, weighted pixels) each, so that small images
+// are done on the calling thread alone.
+void for_rows(int n, std::size_t rowwork, const std::function<void(int, int)> &task)
+{
+    constexpr std::size_t CHUNK_WORK = 1 << 18;
+
+    int chunk = static_cast<int>(std::clamp<std::size_t>(CHUNK_WORK / std::max<std::size_t>(rowwork, 1), 1, n));
+    std::size_t nchunks = (n + chunk - 1) / chunk;
+
+    garglk::parallel_for(nchunks, [&](std::size_t i) {
+        int start = static_cast<int>(i) * chunk;
+        task(start, std::min(start + chunk, n));
+    });
+}
+
+}
+
+static Canvas<4> scale_separable(const picture_t *src, int newcols, int newrows, ImageFilter filter)
+{
+    int cols = src->w;
+    int rows = src->h;
+
+    auto horizontal = contributions(cols, newcols, filter);
+    auto vertical = contributions(rows, newrows, filter);
+
+    Canvas<4> rgba(newcols, newrows);
+
+    std::size_t rowsize = static_cast<std::size_t>(newcols) * 4;
+    std::size_t rowwork = newcols * (vertical.taps + horizontal.taps * std::max(1, rows / newrows));
+
+    // Each chunk of destination rows scales just the source rows it
+    // needs horizontally (a few are shared with the neighboring chunks,
+    // and so done twice), then scales those vertically.
+    for_rows(newrows, rowwork, [&](int start, int end) {
+        int first = vertical.first[start];
+        int last = first;
+        for (int y = start; y < end; y++) {
+            last = std::max(last, vertical.first[y] + vertical.count[y]);
+        }
+
+        std::vector<float> line(static_cast<std::size_t>(cols) * 4);
+        std::vector<float> wide(rowsize * (last - first));
+
+        for (int y = first; y < last; y++) {
+            const unsigned char *in = src->rgba.data() + y * src->rgba.stride();
+            for (int x = 0; x < cols * 4; x += 4) {
+                float alpha = in[x + 3];
+                float mul = alpha * (1.0F / 255);
+                line[x + 0] = in[x + 0] * mul;
+                line[x + 1] = in[x + 1] * mul;
+                line[x + 2] = in[x + 2] * mul;
+                line[x + 3] = alpha;
+            }
+
+            float *out = &wide[(y - first) * rowsize];
+            for (int x = 0; x < newcols; x++) {
+                weighted_sum(&out[x * 4], &line[horizontal.first[x] * 4],
+                        &horizontal.weights[x * horizontal.taps], horizontal.count[x]);
+            }
+        }
+
+        std::vector<float> acc(rowsize);
+
+        for (int y = start; y < end; y++) {
+            std::fill(acc.begin(), acc.end(), 0.0F);
+            for (int k = 0; k < vertical.count[y]; k++) {
+                add_weighted(acc.data(), &wide[(vertical.first[y] + k - first) * rowsize],
+                        vertical.weights[y * vertical.taps + k], rowsize);
+            }
+
+            unsigned char *out = rgba.data() + y * rgba.stride();
+            for (std::size_t x = 0; x < rowsize; x += 4) {
+                float alpha = std::min(acc[x + 3], 255.0F);
+                if (alpha < 0.5F) {
+                    std::fill(&out[x], &out[x + 4], 0);
+                } else {
+                    float mul = 255 / alpha;
+                    out[x + 0] = to_channel(acc[x + 0] * mul);
+                    out[x + 1] = to_channel(acc[x + 1] * mul);
+                    out[x + 2] = to_channel(acc[x + 2] * mul);
+                    out[x + 3] = to_channel(alpha);
+                }
+            }
+        }
+    });
+
+    return rgba;
 }
@@ -0,0 +1,43 @@
+// Copyright (C) 2026 by Chris Spiegel.
+//
+// This file is part of Gargoyle.
+//
+// Gargoyle is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// Gargoyle is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Gargoyle; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+#ifndef GARGLK_SIMD_H
+#define GARGLK_SIMD_H
+
+// Select the widest vector instruction set the compiler is allowed to
+// target. Nothing is detected at runtime: SSE2 is part of the x86-64
+// baseline and NEON of AArch64, so those are always used there, while
+// the AVX2 paths are only built when the compiler is told the target
+// supports them (e.g. -mavx2 or -march=native). Code using these must
+// always provide a scalar fallback which produces identical results.
+// Defining GARGLK_CONFIG_NO_SIMD selects only the scalar code, which the
+// tests use to check it.
+#if defined(GARGLK_CONFIG_NO_SIMD)
+#elif defined(__AVX2__)
+#define GARGLK_SIMD_AVX2
+#define GARGLK_SIMD_SSE2
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GARGLK_SIMD_SSE2
+#include <emmintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define GARGLK_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+#endif
@@ -42,6 +42,7 @@
 #include <QPixmap>
 #include <QProcess>
 #include <QPushButton>
+#include <QRegion>
 #include <QResizeEvent>
 #include <QScreen>
 #include <QSettings>
@@ -125,6 +126,10 @@ static garglk::Window *window;
 
 static bool refresh_needed = true;
 
+// Areas of the framebuffer, in physical pixels, which have changed since
+// the last refresh and need to be repainted.
+static QRegion damage;
+
 static constexpr int TICK_PERIOD_MILLIS = 10;
 static std::atomic<bool> process_events(false);
 
@@ -400,21 +405,60 @@ void garglk::View::inputMethodEvent(QInputMethodEvent *event)
     event->accept();
 }
 
+// Only the windows overlapping the damaged areas are redrawn, and only
+// those areas are repainted. If a refresh was requested without any
+// damage being reported (e.g. on a key press which didn't change
+// anything yet), fall back to redrawing and repainting everything.
 void garglk::View::refresh()
 {
+    bool full = damage.isEmpty();
+
     if (!gli_drawselect) {
-        gli_windows_redraw();
+        if (full) {
+            gli_windows_redraw();
+        } else {
+            std::vector<rect_t> rects;
+            for (const QRect &rect : damage) {
+                rects.push_back({rect.left(), rect.top(), rect.right() + 1, rect.bottom() + 1});
+            }
+
+            gli_windows_redraw_damaged(rects);
+        }
     } else {
         gli_drawselect = false;
     }
 
-    update();
+    if (full) {
+        update();
+    } else {
+        // Convert to logical pixels, rounding outward.
+        double dpr = devicePixelRatioF();
+        QRegion logical;
+        for (const QRect &rect : damage) {
+            int x0 = std::floor(rect.left() / dpr);
+            int y0 = std::floor(rect.top() / dpr);
+            int x1 = std::ceil((rect.right() + 1) / dpr);
+            int y1 = std::ceil((rect.bottom() + 1) / dpr);
+            logical += QRect(x0, y0, x1 - x0, y1 - y0);
+        }
+
+        update(logical);
+    }
+
+    damage = QRegion();
     refresh_needed = false;
 }
 
 void garglk::View::paintEvent(QPaintEvent *event)
 {
-    QImage image(gli_image_rgb.data(), gli_image_rgb.width(), gli_image_rgb.height(), gli_image_rgb.stride(), QImage::Format_RGB888);
+#ifdef GARGLK_CONFIG_XRGB_FRAMEBUFFER
+    // The framebuffer is already in the backing store's native format,
+    // so Qt can blit it as-is instead of converting from RGB888.
+    constexpr auto format = QImage::Format_RGB32;
+#else
+    constexpr auto format = QImage::Format_RGB888;
+#endif
+    QImage image(gli_image_rgb.data(), gli_image_rgb.width(), gli_image_rgb.height(), gli_image_rgb.stride(), format);
     double dpr = devicePixelRatioF();
     // The `QImage` we blit to the widget is sized in **physical**
     // pixels (e.g. 1000×750), but the widget itself is sized in
@@ -423,7 +467,20 @@ void garglk::View::paintEvent(QPaintEvent *event)
     // to the backing store.
     image.setDevicePixelRatio(dpr);
     QPainter painter(this);
-    painter.drawImage(QPoint(0, 0), image);
+
+    // Only blit the parts of the image which need repainting, so that
+    // e.g. typing a character doesn't convert and copy the whole frame.
+    for (const QRect &rect : event->region()) {
+        int x0 = std::floor(rect.left() * dpr);
+        int y0 = std::floor(rect.top() * dpr);
+        int x1 = std::min(static_cast<int>(std::ceil((rect.right() + 1) * dpr)), image.width());
+        int y1 = std::min(static_cast<int>(std::ceil((rect.bottom() + 1) * dpr)), image.height());
+
+        if (x0 < x1 && y0 < y1) {
+            painter.drawImage(QPointF(x0 / dpr, y0 / dpr), image, QRectF(x0, y0, x1 - x0, y1 - y0));
+        }
+    }
+
     event->accept();
 }
 
@@ -865,6 +922,15 @@ void wintitle()
 
 void winrepaint(int x0, int y0, int x1, int y1)
 {
+    x0 = std::max(x0, 0);
+    y0 = std::max(y0, 0);
+    x1 = std::min(x1, gli_image_rgb.width());
+    y1 = std::min(y1, gli_image_rgb.height());
+
+    if (x0 < x1 && y0 < y1) {
+        damage += QRect(x0, y0, x1 - x0, y1 - y0);
+    }
+
     refresh_needed = true;
 }
 
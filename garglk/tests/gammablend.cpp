@@ -0,0 +1,150 @@
+// Check that the gamma blending used to draw glyphs gives exactly what
+// blending one pixel at a time did, for every background and coverage
+// value. This is built once for each kernel the machine can run (see
+// CMakeLists.txt), and checks whichever one it was built with.
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "gammablend.h"
+#include "garglk.h"
+
+namespace {
+
+struct Tables {
+    GammaMap map;
+    GammaInv inv;
+};
+
+// As built by gli_initialize_fonts().
+Tables make_tables(double gamma)
+{
+    Tables tables;
+
+    for (int i = 0; i < 256; i++) {
+        tables.map[i] = std::round(std::pow(i / 255.0, gamma) * GAMMA_MAX);
+    }
+
+    for (int i = 0; i <= GAMMA_MAX; i++) {
+        tables.inv[i] = std::round(std::pow(i / static_cast<double>(GAMMA_MAX), 1.0 / gamma) * 255.0);
+    }
+
+    return tables;
+}
+
+// One channel as the per-pixel code (draw_pixel_gamma() and
+// draw_pixel_lcd_gamma()) blended it.
+unsigned char reference(const Tables &tables, unsigned char color, unsigned char dst, unsigned char alpha)
+{
+    std::uint16_t invalf = GAMMA_MAX - (alpha * GAMMA_MAX / 255);
+    std::uint16_t bg = tables.map[dst];
+    std::uint16_t fg = tables.map[color];
+
+    return tables.inv[fg + mulhigh(static_cast<int>(bg) - fg, invalf)];
+}
+
+// Blend 65536 pixels of text in color "rgb", in spans of varying length
+// so that the vector loops, their scalar tails, and the chunking in
+// between are all used. Each channel sees every combination of
+// background and coverage, each lined up with a different lane.
+template <typename Layout>
+bool check(const std::string &name, const Tables &tables, const Color &rgb, bool lcd)
+{
+    constexpr int N = 65536;
+    constexpr unsigned char PAD = 0x5a;
+
+    std::vector<unsigned char> pixels(N * Layout::size, PAD);
+    std::vector<unsigned char> alpha(lcd ? N * 3 : N);
+    std::vector<std::array<unsigned char, 3>> dst(N), coverage(N);
+
+    for (int i = 0; i < N; i++) {
+        for (int c = 0; c < 3; c++) {
+            dst[i][c] = (i + c * 85) & 0xff;
+            coverage[i][c] = lcd ? ((i >> 8) + c * 101) & 0xff : i >> 8;
+        }
+
+        unsigned char *pixel = &pixels[i * Layout::size];
+        pixel[Layout::r] = dst[i][0];
+        pixel[Layout::g] = dst[i][1];
+        pixel[Layout::b] = dst[i][2];
+
+        if (lcd) {
+            alpha[i * 3 + 0] = coverage[i][0];
+            alpha[i * 3 + 1] = coverage[i][1];
+            alpha[i * 3 + 2] = coverage[i][2];
+        } else {
+            alpha[i] = coverage[i][0];
+        }
+    }
+
+    GammaBlender<Layout> blender(rgb, tables.map, tables.inv);
+
+    for (int i = 0, k = 0; i < N; k++) {
+        int n = std::min(N - i, 1 + (k * 37) % 250);
+        blender.blend(&pixels[i * Layout::size], &alpha[lcd ? i * 3 : i], n, lcd);
+        i += n;
+    }
+
+    for (int i = 0; i < N; i++) {
+        const unsigned char *pixel = &pixels[i * Layout::size];
+        std::array<unsigned char, 3> got = {pixel[Layout::r], pixel[Layout::g], pixel[Layout::b]};
+
+        for (int c = 0; c < 3; c++) {
+            auto want = reference(tables, rgb[c], dst[i][c], coverage[i][c]);
+            if (got[c] != want) {
+                std::cerr << name << ": color " << int(rgb[0]) << "," << int(rgb[1]) << "," << int(rgb[2])
+                          << ", channel " << c << " over " << int(dst[i][c]) << " at coverage " << int(coverage[i][c])
+                          << ": got " << int(got[c]) << ", expected " << int(want) << "\n";
+                return false;
+            }
+        }
+
+        if constexpr (Layout::size == 4) {
+            if (pixel[Layout::x] != PAD) {
+                std::cerr << name << ": padding byte changed\n";
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+}
+
+int main()
+{
+#if defined(GARGLK_SIMD_AVX2)
+    std::cout << "checking the AVX2 kernel\n";
+#elif defined(GARGLK_SIMD_SSE2)
+    std::cout << "checking the SSE2 kernel\n";
+#elif defined(GARGLK_SIMD_NEON)
+    std::cout << "checking the NEON kernel\n";
+#else
+    std::cout << "checking the scalar kernel\n";
+#endif
+
+    bool ok = true;
+
+    for (double gamma : {1.0, 1.8, 2.2}) {
+        auto tables = make_tables(gamma);
+
+        for (int v = 0; v < 256; v += 17) {
+            Color rgb(v, 255 - v, (v * 7) & 0xff);
+
+            for (bool lcd : {false, true}) {
+                std::string mode = lcd ? "lcd" : "grayscale";
+                ok = check<garglk::LayoutRGB888>("RGB888 " + mode, tables, rgb, lcd) && ok;
+                ok = check<garglk::LayoutXRGB8888>("XRGB8888 " + mode, tables, rgb, lcd) && ok;
+            }
+        }
+    }
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
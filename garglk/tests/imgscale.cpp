@@ -0,0 +1,145 @@
+// Check that the box filter stays within the bounds garglk.ini documents
+// for how far it may differ from the classic (pnmscale) scaler.
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "garglk.h"
+
+namespace {
+
+constexpr int SRCW = 96;
+constexpr int SRCH = 72;
+
+// A deterministic stand-in for rand(), so the inputs are the same
+// everywhere.
+class Random {
+public:
+    unsigned char next() {
+        m_seed = m_seed * 1103515245 + 12345;
+        return (m_seed >> 16) & 0xff;
+    }
+
+private:
+    unsigned long m_seed = 12345;
+};
+
+picture_t make_picture(const std::string &kind)
+{
+    Canvas<4> canvas(SRCW, SRCH);
+    Random random;
+
+    for (int y = 0; y < SRCH; y++) {
+        for (int x = 0; x < SRCW; x++) {
+            unsigned char r, g, b, a = 0xff;
+
+            if (kind == "noise") {
+                r = random.next();
+                g = random.next();
+                b = random.next();
+            } else if (kind == "gradient") {
+                r = x * 255 / (SRCW - 1);
+                g = y * 255 / (SRCH - 1);
+                b = (x + y) * 255 / (SRCW + SRCH - 2);
+            } else {
+                // Pixel art: flat 8x8 blocks with hard edges, some of
+                // them partly or fully transparent.
+                int block = (x / 8) * 7 + (y / 8) * 3;
+                r = (block * 53) & 0xff;
+                g = (block * 97) & 0xff;
+                b = (block * 151) & 0xff;
+                a = block % 5 == 0 ? 0x00 : block % 5 == 1 ? 0x80 : 0xff;
+            }
+
+            canvas[y][x] = Pixel<4>(r, g, b, a);
+        }
+    }
+
+    return picture_t(0, std::move(canvas), false);
+}
+
+struct Difference {
+    int max = 0;
+    double mean = 0;
+};
+
+Difference compare(const Canvas<4> &classic, const Canvas<4> &box)
+{
+    Difference difference;
+    long total = 0, count = 0;
+
+    for (int y = 0; y < classic.height(); y++) {
+        for (int x = 0; x < classic.width(); x++) {
+            const auto *c = classic[y][x];
+            const auto *b = box[y][x];
+
+            // The color of a pixel which is all but transparent can't
+            // be seen, and the two scalers don't agree on it, so only
+            // its alpha is compared.
+            int first = std::min(c[3], b[3]) < 4 ? 3 : 0;
+
+            for (int i = first; i < 4; i++) {
+                int diff = std::abs(c[i] - b[i]);
+                difference.max = std::max(difference.max, diff);
+                total += diff;
+                count++;
+            }
+        }
+    }
+
+    difference.mean = static_cast<double>(total) / count;
+
+    return difference;
+}
+
+}
+
+int main()
+{
+    struct Size {
+        int w, h;
+        int maxdiff;
+    };
+
+    // Colors typically differ by 1 or 2, but at awkward sizes classic's
+    // rounding can move a sharp edge, which costs up to about 20.
+    const std::vector<Size> sizes = {
+        {SRCW * 2, SRCH * 2, 3},
+        {SRCW * 3 / 2, SRCH * 3 / 2, 3},
+        {SRCW / 2, SRCH / 2, 3},
+        {SRCW / 3 + 1, SRCH / 3 + 1, 20},
+    };
+
+    bool ok = true;
+
+    for (const std::string kind : {"noise", "gradient", "pixelart"}) {
+        auto src = make_picture(kind);
+
+        for (const auto &size : sizes) {
+            auto classic = gli_picture_resample(&src, size.w, size.h, ImageFilter::Classic);
+            auto box = gli_picture_resample(&src, size.w, size.h, ImageFilter::Box);
+
+            if (classic.width() != size.w || classic.height() != size.h ||
+                box.width() != size.w || box.height() != size.h) {
+                std::cerr << kind << " " << size.w << "x" << size.h << ": wrong output size\n";
+                ok = false;
+                continue;
+            }
+
+            auto difference = compare(classic, box);
+
+            std::cout << kind << " " << size.w << "x" << size.h << ": max " << difference.max << ", mean " << difference.mean << "\n";
+
+            if (difference.max > size.maxdiff || difference.mean > 2) {
+                std::cerr << kind << " " << size.w << "x" << size.h << ": box differs from classic by more than expected\n";
+                ok = false;
+            }
+        }
+    }
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -32,6 +32,10 @@
 bool gli_force_redraw = true;
 bool gli_more_focus = false;
 
+// While gli_windows_redraw_damaged() is running, the areas which need
+// to be redrawn; windows outside of them are skipped.
+static const std::vector<rect_t> *redraw_damage = nullptr;
+
 // Linked list of all windows
 static window_t *gli_windowlist = nullptr;
 
@@ -761,9 +765,21 @@ void gli_windows_size_change(int w, int h, bool post_arrange_event)
 
 void gli_window_redraw(window_t *win)
 {
+    int y0 = win->yadj != 0 ? win->bbox.y0 - win->yadj : win->bbox.y0;
+
+    if (redraw_damage != nullptr && !gli_force_redraw) {
+        bool damaged = std::any_of(redraw_damage->begin(), redraw_damage->end(), [win, y0](const rect_t &rect) {
+            return rect.x0 < win->bbox.x1 && rect.x1 > win->bbox.x0 &&
+                   rect.y0 < win->bbox.y1 && rect.y1 > y0;
+        });
+
+        if (!damaged) {
+            return;
+        }
+    }
+
     if (gli_force_redraw) {
         Color color = gli_override_bg.has_value() ? gli_window_color : win->bgcolor;
-        int y0 = win->yadj != 0 ? win->bbox.y0 - win->yadj : win->bbox.y0;
         gli_draw_rect(win->bbox.x0, y0,
                 win->bbox.x1 - win->bbox.x0,
                 win->bbox.y1 - y0,
@@ -825,10 +841,29 @@ void gli_windows_redraw()
     gli_force_redraw = false;
 }
 
+// Redraw only the windows which overlap the damaged areas (in
+// framebuffer coordinates), unless a full redraw has been requested.
+// Every change to a window marks its area as damaged via winrepaint(),
+// so the remaining windows have nothing to draw.
+void gli_windows_redraw_damaged(const std::vector<rect_t> &damage)
+{
+    redraw_damage = &damage;
+    gli_windows_redraw();
+    redraw_damage = nullptr;
+}
+
 void gli_redraw_rect(int x0, int y0, int x1, int y1)
 {
     gli_drawselect = true;
-    winrepaint(x0, y0, x1, y1);
+    gli_repaint_text(x0, y0, x1, y1);
+}
+
+// Damage an area which text is drawn into. Glyphs can overhang the area
+// they're laid out in (italics, or a negative bearing at the start of a
+// line), so a little more is damaged on every side.
+void gli_repaint_text(int x0, int y0, int x1, int y1)
+{
+    winrepaint(x0 - gli_cellw, y0 - 2, x1 + gli_cellw, y1 + 2);
 }
 
 //
@@ -1142,6 +1177,18 @@ void gli_window_put_char_uni(window_t *win, glui32 ch)
     }
 }
 
+void gli_window_put_buffer_uni(window_t *win, const glui32 *buf, std::size_t len)
+{
+    switch (win->type) {
+    case wintype_TextBuffer:
+        win_textbuffer_putbuffer_uni(win, buf, len);
+        break;
+    case wintype_TextGrid:
+        win_textgrid_putbuffer_uni(win, buf, len);
+        break;
+    }
+}
+
 bool gli_window_unput_char_uni(window_t *win, glui32 ch)
 {
     switch (win->type) {
@@ -1339,6 +1386,29 @@ void glk_window_fill_rect(winid_t win, glui32 color,
     win_graphics_fill_rect(win->wingraphics(), color, left, top, width, height);
 }
 
+void garglk_window_draw_pixels(winid_t win, const void *pixels,
+        glui32 format, glui32 stride, const glui32 *palette,
+        glsi32 left, glsi32 top, glui32 width, glui32 height, glui32 scale)
+{
+    if (win == nullptr) {
+        gli_strict_warning("window_draw_pixels: invalid ref");
+        return;
+    }
+    if (win->type != wintype_Graphics) {
+        gli_strict_warning("window_draw_pixels: not a graphics window");
+        return;
+    }
+    if (pixels == nullptr || (format == pixels_Indexed && palette == nullptr)) {
+        gli_strict_warning("window_draw_pixels: no pixels or palette");
+        return;
+    }
+    if (format != pixels_Indexed && format != pixels_RGB) {
+        gli_strict_warning("window_draw_pixels: invalid format");
+        return;
+    }
+    win_graphics_draw_pixels(win->wingraphics(), pixels, format, stride, palette, left, top, width, height, scale);
+}
+
 void glk_window_set_background_color(winid_t win, glui32 color)
 {
     if (win == nullptr) {
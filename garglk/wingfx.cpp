@@ -17,20 +17,41 @@
 // along with Gargoyle; if not, write to the Free Software
 // Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 
+#include <algorithm>
+#include <cstring>
 #include <memory>
+#include <type_traits>
+#include <vector>
 
 #include "glk.h"
 #include "garglk.h"
 
-#define mul255(a,b) (((short)(a) * (b) + 127) / 255)
-
 static void
 drawpicture(const picture_t *src, window_graphics_t *dst,
     int x0, int y0, int width, int height, glui32 linkval);
 
+// Once a window has more separate damaged areas than this, they are
+// replaced by their bounding box.
+static constexpr std::size_t MAX_DAMAGE = 16;
+
+static bool touching(const rect_t &a, const rect_t &b)
+{
+    return a.x0 <= b.x1 && b.x0 <= a.x1 && a.y0 <= b.y1 && b.y0 <= a.y1;
+}
+
+static void merge(rect_t &a, const rect_t &b)
+{
+    a.x0 = std::min(a.x0, b.x0);
+    a.y0 = std::min(a.y0, b.y0);
+    a.x1 = std::max(a.x1, b.x1);
+    a.y1 = std::max(a.y1, b.y1);
+}
+
+// Mark the whole window as needing to be redrawn.
 static void win_graphics_touch(window_graphics_t *dest)
 {
     dest->dirty = true;
+    dest->damage.clear();
     winrepaint(
             dest->owner->bbox.x0,
             dest->owner->bbox.y0,
@@ -38,6 +59,90 @@ static void win_graphics_touch(window_graphics_t *dest)
             dest->owner->bbox.y1);
 }
 
+// Mark part of the window (in window coordinates) as needing to be
+// redrawn. Areas which overlap or touch are combined, so drawing a
+// sprite one pixel at a time ends up as a single rectangle.
+static void win_graphics_touch(window_graphics_t *dest, int x0, int y0, int x1, int y1)
+{
+    rect_t rect{
+        std::max(x0, 0),
+        std::max(y0, 0),
+        std::min(x1, dest->w),
+        std::min(y1, dest->h),
+    };
+
+    if (rect.x0 >= rect.x1 || rect.y0 >= rect.y1) {
+        return;
+    }
+
+    if (!dest->dirty) {
+        auto &damage = dest->damage;
+        bool merged;
+
+        do {
+            merged = false;
+            for (auto it = damage.begin(); it != damage.end(); ++it) {
+                if (touching(rect, *it)) {
+                    merge(rect, *it);
+                    damage.erase(it);
+                    merged = true;
+                    break;
+                }
+            }
+        } while (merged);
+
+        damage.push_back(rect);
+
+        if (damage.size() > MAX_DAMAGE) {
+            for (const auto &other : damage) {
+                merge(rect, other);
+            }
+            damage.assign(1, rect);
+        }
+    }
+
+    winrepaint(
+            dest->owner->bbox.x0 + rect.x0,
+            dest->owner->bbox.y0 + rect.y0,
+            dest->owner->bbox.x0 + rect.x1,
+            dest->owner->bbox.y0 + rect.y1);
+}
+
+// Copy part of the window (in window coordinates) to the framebuffer a
+// row at a time, converting to the framebuffer's layout if it differs.
+static void copy_to_framebuffer(window_graphics_t *dwin, const rect_t &rect)
+{
+    using Layout = garglk::FramebufferLayout;
+
+    int wx = dwin->owner->bbox.x0;
+    int wy = dwin->owner->bbox.y0;
+
+    int x0 = std::max(rect.x0, -wx);
+    int y0 = std::max(rect.y0, -wy);
+    int x1 = std::min(rect.x1, gli_image_rgb.width() - wx);
+    int y1 = std::min(rect.y1, gli_image_rgb.height() - wy);
+
+    if (x0 >= x1 || y0 >= y1) {
+        return;
+    }
+
+    int n = x1 - x0;
+
+    for (int y = y0; y < y1; y++) {
+        const unsigned char *src = dwin->rgb.data() + y * dwin->rgb.stride() + x0 * 3;
+        unsigned char *dst = gli_image_rgb.data() + (wy + y) * gli_image_rgb.stride() + (wx + x0) * Layout::size;
+
+        if constexpr (std::is_same_v<Layout, garglk::LayoutRGB888>) {
+            std::memcpy(dst, src, n * 3);
+        } else {
+            for (int i = 0; i < n; i++, src += 3, dst += Layout::size) {
+                auto pixel = Layout::pixel(Color(src[0], src[1], src[2]));
+                std::memcpy(dst, pixel.data(), Layout::size);
+            }
+        }
+    }
+}
+
 void win_graphics_rearrange(window_t *win, rect_t *box)
 {
     window_graphics_t *dwin = win->wingraphics();
@@ -75,24 +180,23 @@ void win_graphics_rearrange(window_t *win, rect_t *box)
 void win_graphics_redraw(window_t *win)
 {
     window_graphics_t *dwin = win->wingraphics();
-    int x, y;
 
-    int x0 = win->bbox.x0;
-    int y0 = win->bbox.y0;
-
-    if (dwin->dirty || gli_force_redraw) {
+    if (dwin->rgb.empty()) {
         dwin->dirty = false;
+        dwin->damage.clear();
+        return;
+    }
 
-        if (dwin->rgb.empty()) {
-            return;
-        }
-
-        for (y = 0; y < dwin->h; y++) {
-            for (x = 0; x < dwin->w; x++) {
-                gli_draw_pixel(x + x0, y + y0, dwin->rgb[y][x]);
-            }
+    if (dwin->dirty || gli_force_redraw) {
+        copy_to_framebuffer(dwin, rect_t{0, 0, dwin->w, dwin->h});
+    } else {
+        for (const auto &rect : dwin->damage) {
+            copy_to_framebuffer(dwin, rect);
         }
     }
+
+    dwin->dirty = false;
+    dwin->damage.clear();
 }
 
 void win_graphics_click(window_graphics_t *dwin, int sx, int sy)
@@ -134,17 +238,30 @@ bool win_graphics_draw_picture(std::shared_ptr<picture_t> pic, window_graphics_t
 
     drawpicture(pic.get(), dwin, xpos, ypos, imagewidth, imageheight, hyperlink);
 
-    win_graphics_touch(dwin);
-
     return true;
 }
 
+// Fill part of the window's canvas (already clipped to it) with a
+// single color: the first row is filled, and the rest copied from it.
+static void fill_canvas(window_graphics_t *dwin, const Color &color, int x0, int y0, int x1, int y1)
+{
+    if (x0 >= x1 || y0 >= y1) {
+        return;
+    }
+
+    dwin->rgb[y0].fill(color, x0, x1);
+
+    const unsigned char *first = dwin->rgb.data() + y0 * dwin->rgb.stride() + x0 * 3;
+    for (int y = y0 + 1; y < y1; y++) {
+        std::memcpy(dwin->rgb.data() + y * dwin->rgb.stride() + x0 * 3, first, (x1 - x0) * 3);
+    }
+}
+
 void win_graphics_erase_rect(window_graphics_t *dwin, bool whole,
     glsi32 x0, glsi32 y0, glui32 width, glui32 height)
 {
     int x1 = x0 + width;
     int y1 = y0 + height;
-    int x, y;
     int hx0, hx1, hy0, hy1;
 
     if (whole) {
@@ -187,13 +304,13 @@ void win_graphics_erase_rect(window_graphics_t *dwin, bool whole,
     // zero out hyperlinks for these coordinates
     gli_put_hyperlink(0, hx0, hy0, hx1, hy1);
 
-    for (y = y0; y < y1; y++) {
-        for (x = x0; x < x1; x++) {
-            dwin->rgb[y][x] = dwin->bgnd;
-        }
-    }
+    fill_canvas(dwin, dwin->bgnd, x0, y0, x1, y1);
 
-    win_graphics_touch(dwin);
+    if (whole) {
+        win_graphics_touch(dwin);
+    } else {
+        win_graphics_touch(dwin, x0, y0, x1, y1);
+    }
 }
 
 void win_graphics_fill_rect(window_graphics_t *dwin, glui32 color,
@@ -205,7 +322,6 @@ void win_graphics_fill_rect(window_graphics_t *dwin, glui32 color,
     y0 = gli_zoom_int(y0);
     x1 = gli_zoom_int(x1);
     y1 = gli_zoom_int(y1);
-    int x, y;
     int hx0, hx1, hy0, hy1;
 
     Pixel<3> col((color >> 16) & 0xff,
@@ -225,13 +341,66 @@ void win_graphics_fill_rect(window_graphics_t *dwin, glui32 color,
     // zero out hyperlinks for these coordinates
     gli_put_hyperlink(0, hx0, hy0, hx1, hy1);
 
-    for (y = y0; y < y1; y++) {
-        for (x = x0; x < x1; x++) {
-            dwin->rgb[y][x] = col;
+    fill_canvas(dwin, col, x0, y0, x1, y1);
+
+    win_graphics_touch(dwin, x0, y0, x1, y1);
+}
+
+// Draw a whole image of "width" by "height" pixels, each "scale" pixels
+// square, exactly as if each pixel had been drawn by its own call to
+// win_graphics_fill_rect(): the edges of every pixel are zoomed
+// separately, so rounding comes out the same. Hyperlinks are cleared
+// over the whole image, transparent pixels included.
+void win_graphics_draw_pixels(window_graphics_t *dwin, const void *pixels,
+    glui32 format, glui32 stride, const glui32 *palette,
+    glsi32 x0, glsi32 y0, glui32 width, glui32 height, glui32 scale)
+{
+    std::vector<int> xs(width + 1), ys(height + 1);
+    for (glui32 i = 0; i <= width; i++) {
+        xs[i] = std::clamp(gli_zoom_int(x0 + static_cast<glsi32>(i * scale)), 0, dwin->w);
+    }
+    for (glui32 i = 0; i <= height; i++) {
+        ys[i] = std::clamp(gli_zoom_int(y0 + static_cast<glsi32>(i * scale)), 0, dwin->h);
+    }
+
+    int hx0 = dwin->owner->bbox.x0 + xs[0];
+    int hx1 = dwin->owner->bbox.x0 + xs[width];
+    int hy0 = dwin->owner->bbox.y0 + ys[0];
+    int hy1 = dwin->owner->bbox.y0 + ys[height];
+
+    // zero out hyperlinks for these coordinates
+    gli_put_hyperlink(0, hx0, hy0, hx1, hy1);
+
+    const auto *indexed = static_cast<const unsigned char *>(pixels);
+    const auto *rgb = static_cast<const glui32 *>(pixels);
+
+    for (glui32 y = 0; y < height; y++) {
+        if (ys[y] == ys[y + 1]) {
+            continue;
+        }
+
+        for (glui32 x = 0; x < width; x++) {
+            if (xs[x] == xs[x + 1]) {
+                continue;
+            }
+
+            std::size_t i = static_cast<std::size_t>(y) * stride + x;
+            glui32 color = format == pixels_Indexed ? palette[indexed[i]] : rgb[i];
+            if (color > 0xffffff) {
+                continue;
+            }
+
+            Pixel<3> col((color >> 16) & 0xff,
+                         (color >> 8) & 0xff,
+                         (color >> 0) & 0xff);
+
+            for (int row = ys[y]; row < ys[y + 1]; row++) {
+                dwin->rgb[row].fill(col, xs[x], xs[x + 1]);
+            }
         }
     }
 
-    win_graphics_touch(dwin);
+    win_graphics_touch(dwin, xs[0], ys[0], xs[width], ys[height]);
 }
 
 void win_graphics_set_background_color(window_graphics_t *dwin, glui32 color)
@@ -301,17 +470,7 @@ static void drawpicture(const picture_t *src, window_graphics_t *dst,
     w = sx1 - sx0;
     h = sy1 - sy0;
 
-    for (int y = 0; y < h; y++) {
-        for (int x = 0; x < w; x++) {
-            auto existing = dst->rgb[y + y0][x + x0];
-            unsigned char sa = src->rgba[y + sy0][x + sx0][3];
-            unsigned char na = 255 - sa;
-            unsigned char sr = mul255(src->rgba[y + sy0][x + sx0][0], sa);
-            unsigned char sg = mul255(src->rgba[y + sy0][x + sx0][1], sa);
-            unsigned char sb = mul255(src->rgba[y + sy0][x + sx0][2], sa);
-            dst->rgb[y + y0][x + x0] =Pixel<3>(sr + mul255(existing[0], na),
-                                               sg + mul255(existing[1], na),
-                                               sb + mul255(existing[2], na));
-        }
-    }
+    gli_blend_picture(dst->rgb, x0, y0, src, sx0, sy0, w, h);
+
+    win_graphics_touch(dst, x0, y0, x1, y1);
 }
@@ -18,6 +18,8 @@
 // Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 
 #include <algorithm>
+#include <cstring>
+#include <vector>
 
 #include "glk.h"
 #include "garglk.h"
@@ -26,12 +28,31 @@
 // Within a line, just store an array of characters and an array
 // of style bytes, the same size.
 
-static void touch(window_textgrid_t *dwin, int line)
+// Mark the columns from "x0" up to "x1" of a line as changed. A glyph can
+// overhang its cell, which gli_repaint_text() allows for by repainting a
+// cell's width either side as well.
+static void touch(window_textgrid_t *dwin, int line, int x0, int x1)
 {
     window_t *win = dwin->owner;
+    tgline_t &ln = dwin->lines[line];
     int y = win->bbox.y0 + line * gli_leading;
-    dwin->lines[line].dirty = true;
-    winrepaint(win->bbox.x0, y, win->bbox.x1, y + gli_leading);
+
+    if (ln.dirtybeg >= ln.dirtyend) {
+        ln.dirtybeg = x0;
+        ln.dirtyend = x1;
+    } else {
+        ln.dirtybeg = std::min(ln.dirtybeg, x0);
+        ln.dirtyend = std::max(ln.dirtyend, x1);
+    }
+
+    x0 = win->bbox.x0 + x0 * gli_cellw;
+    x1 = x1 < dwin->width ? win->bbox.x0 + x1 * gli_cellw : win->bbox.x1;
+    gli_repaint_text(x0, y, x1, y + gli_leading);
+}
+
+static void touch(window_textgrid_t *dwin, int line)
+{
+    touch(dwin, line, 0, dwin->width);
 }
 
 void win_textgrid_rearrange(window_t *win, rect_t *box)
@@ -48,9 +69,22 @@ void win_textgrid_rearrange(window_t *win, rect_t *box)
         return;
     }
 
+    if (newhgt > static_cast<int>(dwin->lines.size())) {
+        dwin->lines.resize(newhgt);
+    }
+
+    std::size_t storewid = std::max(newwid, 0);
+    if (!dwin->lines.empty()) {
+        storewid = std::max(storewid, dwin->lines[0].chars.size());
+    }
+    for (auto &ln : dwin->lines) {
+        ln.chars.resize(storewid, ' ');
+        ln.attrs.resize(storewid);
+    }
+
     for (k = dwin->height; k < newhgt; k++) {
-        dwin->lines[k].chars.fill(' ');
-        dwin->lines[k].attrs.fill(attr_t{});
+        std::fill(dwin->lines[k].chars.begin(), dwin->lines[k].chars.end(), ' ');
+        std::fill(dwin->lines[k].attrs.begin(), dwin->lines[k].attrs.end(), attr_t{});
     }
 
     dwin->owner->attr.clear();
@@ -60,13 +94,48 @@ void win_textgrid_rearrange(window_t *win, rect_t *box)
     for (k = 0; k < dwin->height; k++) {
         touch(dwin, k);
         std::fill(dwin->lines[k].chars.begin() + dwin->width, dwin->lines[k].chars.end(), ' ');
-        auto *attr_end = (&dwin->lines[k].attrs[0]) + dwin->lines[k].attrs.size();
-        for (auto *attr = &dwin->lines[k].attrs[dwin->width]; attr < attr_end; ++attr) {
+        for (auto attr = dwin->lines[k].attrs.begin() + dwin->width; attr != dwin->lines[k].attrs.end(); ++attr) {
             attr->clear();
         }
     }
 }
 
+// Copy the pixels of one row of cells from "x0" to "x1" out of the
+// framebuffer, or back into it.
+static std::vector<unsigned char> save_pixels(int x0, int x1, int y)
+{
+    x0 = std::clamp(x0, 0, gli_image_rgb.width());
+    x1 = std::clamp(x1, x0, gli_image_rgb.width());
+    int y1 = std::min(y + gli_leading, gli_image_rgb.height());
+    std::size_t rowsize = (x1 - x0) * garglk::FramebufferLayout::size;
+    std::vector<unsigned char> pixels;
+
+    for (int row = std::max(y, 0); row < y1; row++) {
+        const unsigned char *src = gli_image_rgb.data() + row * gli_image_rgb.stride() + x0 * garglk::FramebufferLayout::size;
+        pixels.insert(pixels.end(), src, src + rowsize);
+    }
+
+    return pixels;
+}
+
+static void restore_pixels(const std::vector<unsigned char> &pixels, int x0, int x1, int y)
+{
+    if (pixels.empty()) {
+        return;
+    }
+
+    x0 = std::clamp(x0, 0, gli_image_rgb.width());
+    x1 = std::clamp(x1, x0, gli_image_rgb.width());
+    int y1 = std::min(y + gli_leading, gli_image_rgb.height());
+    std::size_t rowsize = (x1 - x0) * garglk::FramebufferLayout::size;
+    const unsigned char *src = pixels.data();
+
+    for (int row = std::max(y, 0); row < y1; row++) {
+        std::memcpy(gli_image_rgb.data() + row * gli_image_rgb.stride() + x0 * garglk::FramebufferLayout::size, src, rowsize);
+        src += rowsize;
+    }
+}
+
 void win_textgrid_redraw(window_t *win) {
     window_textgrid_t *dwin = win->wingrid();
     int x0 = win->bbox.x0;
@@ -101,62 +170,115 @@ void win_textgrid_redraw(window_t *win) {
 
     for (int i = 0; i < dwin->height; i++) {
         tgline_t *ln = &dwin->lines[i];
-        if (!ln->dirty && !gli_force_redraw) {
+        int dirtybeg = gli_force_redraw ? 0 : ln->dirtybeg;
+        int dirtyend = gli_force_redraw ? dwin->width : std::min(ln->dirtyend, dwin->width);
+        ln->dirtybeg = 0;
+        ln->dirtyend = 0;
+        if (dirtybeg >= dirtyend) {
             continue;
         }
-        ln->dirty = false;
 
-        int x = x0;
         int y = y0 + i * gli_leading;
 
+        // Only the changed cells and their neighbours (which a changed
+        // glyph may overhang, or be overhung by) need to look any
+        // different. To get the neighbours right, draw two cells either
+        // side of the changed ones, then put back the pixels beyond the
+        // neighbours: the outer cells have lost whatever overhangs them
+        // from further out, and what they overhang has been drawn twice.
+        int from = std::max(dirtybeg - 2, 0);
+        int to = std::min(dirtyend + 2, dwin->width);
+        int keepbeg = std::max(dirtybeg - 1, 0);
+        int keepend = std::min(dirtyend + 1, dwin->width);
+        std::vector<unsigned char> left, right;
+
+        if (keepbeg > 0) {
+            left = save_pixels(std::max(x0 + (from - 1) * gli_cellw, win->bbox.x0), x0 + keepbeg * gli_cellw, y);
+        }
+        if (keepend < dwin->width) {
+            right = save_pixels(x0 + keepend * gli_cellw, std::min(x0 + (to + 1) * gli_cellw, win->bbox.x1), y);
+        }
+
+        int x = x0 + from * gli_cellw;
+
         // Clear any stored hyperlink coordinates.
-        gli_put_hyperlink(0, x0, y, x0 + gli_cellw * dwin->width, y + gli_leading);
+        gli_put_hyperlink(0, x, y, x0 + gli_cellw * to, y + gli_leading);
 
         // Draw runs of contiguous cells that share the same styling.
-        for (int start = 0, end = 1; end <= dwin->width; end++) {
-            if (end == dwin->width || ln->attrs[end] != ln->attrs[start]) {
+        for (int start = from, end = from + 1; end <= to; end++) {
+            if (end == to || ln->attrs[end] != ln->attrs[start]) {
                 x += draw_run(ln, start, end, x, y);
                 start = end;
             }
         }
+
+        if (keepbeg > 0) {
+            restore_pixels(left, std::max(x0 + (from - 1) * gli_cellw, win->bbox.x0), x0 + keepbeg * gli_cellw, y);
+        }
+        if (keepend < dwin->width) {
+            restore_pixels(right, x0 + keepend * gli_cellw, std::min(x0 + (to + 1) * gli_cellw, win->bbox.x1), y);
+        }
     }
 }
 
-void win_textgrid_putchar_uni(window_t *win, glui32 ch)
+void win_textgrid_putbuffer_uni(window_t *win, const glui32 *buf, std::size_t len)
 {
     window_textgrid_t *dwin = win->wingrid();
     tgline_t *ln;
+    int touched = -1, touchbeg = 0, touchend = 0;
+
+    for (std::size_t i = 0; i < len; i++) {
+        // Canonicalize the cursor position. That is, the cursor may have been
+        // left outside the window area; wrap it if necessary.
+        if (dwin->curx < 0) {
+            dwin->curx = 0;
+        } else if (dwin->curx >= dwin->width) {
+            dwin->curx = 0;
+            dwin->cury++;
+        }
+        if (dwin->cury < 0) {
+            dwin->cury = 0;
+        } else if (dwin->cury >= dwin->height) {
+            break; // outside the window, as is everything after this
+        }
 
-    // Canonicalize the cursor position. That is, the cursor may have been
-    // left outside the window area; wrap it if necessary.
-    if (dwin->curx < 0) {
-        dwin->curx = 0;
-    } else if (dwin->curx >= dwin->width) {
-        dwin->curx = 0;
-        dwin->cury++;
-    }
-    if (dwin->cury < 0) {
-        dwin->cury = 0;
-    } else if (dwin->cury >= dwin->height) {
-        return; // outside the window
-    }
+        if (buf[i] == '\n') {
+            // a newline just moves the cursor.
+            dwin->cury++;
+            dwin->curx = 0;
+            continue;
+        }
 
-    if (ch == '\n') {
-        // a newline just moves the cursor.
-        dwin->cury++;
-        dwin->curx = 0;
-        return;
-    }
+        // Only the span of each line that's written to is redrawn.
+        if (dwin->cury != touched) {
+            if (touched != -1) {
+                touch(dwin, touched, touchbeg, touchend);
+            }
+            touched = dwin->cury;
+            touchbeg = dwin->curx;
+            touchend = dwin->curx + 1;
+        } else {
+            touchbeg = std::min(touchbeg, dwin->curx);
+            touchend = std::max(touchend, dwin->curx + 1);
+        }
 
-    touch(dwin, dwin->cury);
+        ln = &(dwin->lines[dwin->cury]);
+        ln->chars[dwin->curx] = buf[i];
+        ln->attrs[dwin->curx] = win->attr;
 
-    ln = &(dwin->lines[dwin->cury]);
-    ln->chars[dwin->curx] = ch;
-    ln->attrs[dwin->curx] = win->attr;
+        dwin->curx++;
+        // We can leave the cursor outside the window, since it will be
+        // canonicalized next time a character is printed.
+    }
 
-    dwin->curx++;
-    // We can leave the cursor outside the window, since it will be
-    // canonicalized next time a character is printed.
+    if (touched != -1) {
+        touch(dwin, touched, touchbeg, touchend);
+    }
+}
+
+void win_textgrid_putchar_uni(window_t *win, glui32 ch)
+{
+    win_textgrid_putbuffer_uni(win, &ch, 1);
 }
 
 bool win_textgrid_unputchar_uni(window_t *win, glui32 ch)
@@ -198,7 +320,7 @@ bool win_textgrid_unputchar_uni(window_t *win, glui32 ch)
     if (glk_char_to_upper(ln->chars[dwin->curx]) == glk_char_to_upper(ch)) {
         ln->chars[dwin->curx] = ' ';
         ln->attrs[dwin->curx].clear();
-        touch(dwin, dwin->cury);
+        touch(dwin, dwin->cury, dwin->curx, dwin->curx + 1);
         return true; // deleted the char
     } else {
         dwin->curx = oldx;
@@ -218,8 +340,8 @@ void win_textgrid_clear(window_t *win)
 
     for (k = 0; k < dwin->height; k++) {
         touch(dwin, k);
-        dwin->lines[k].chars.fill(' ');
-        dwin->lines[k].attrs.fill(attr_t{});
+        std::fill(dwin->lines[k].chars.begin(), dwin->lines[k].chars.end(), ' ');
+        std::fill(dwin->lines[k].attrs.begin(), dwin->lines[k].attrs.end(), attr_t{});
     }
 
     dwin->curx = 0;
@@ -283,8 +405,11 @@ static void win_textgrid_init_impl(window_t *win, void *buf, int maxlen, int ini
 
     dwin->inunicode = unicode;
     dwin->inoriglen = maxlen;
-    if (maxlen > (dwin->width - dwin->curx)) {
-        maxlen = (dwin->width - dwin->curx);
+    // There's no room for input if the cursor is outside the window.
+    if (dwin->cury < 0 || dwin->cury >= dwin->height) {
+        maxlen = 0;
+    } else if (maxlen > (dwin->width - dwin->curx)) {
+        maxlen = std::max(dwin->width - dwin->curx, 0);
     }
 
     dwin->inbuf = buf;
@@ -300,7 +425,7 @@ static void win_textgrid_init_impl(window_t *win, void *buf, int maxlen, int ini
         initlen = maxlen;
     }
 
-    if (initlen != 0) {
+    if (initlen > 0) {
         int ix;
         tgline_t *ln = &(dwin->lines[dwin->inorgy]);
 
@@ -318,7 +443,7 @@ static void win_textgrid_init_impl(window_t *win, void *buf, int maxlen, int ini
         dwin->curx = dwin->inorgx + dwin->incurs;
         dwin->cury = dwin->inorgy;
 
-        touch(dwin, dwin->inorgy);
+        touch(dwin, dwin->inorgy, dwin->inorgx, dwin->inorgx + initlen);
     }
 
     if (gli_register_arr != nullptr) {
@@ -344,12 +469,13 @@ static void accept_or_cancel(window_t *win, event_t *ev, bool echo)
     bool inunicode;
     gidispatch_rock_t inarrayrock;
     window_textgrid_t *dwin = win->wingrid();
-    tgline_t *ln = &(dwin->lines[dwin->inorgy]);
 
     if (dwin->inbuf == nullptr) {
         return;
     }
 
+    tgline_t *ln = dwin->inmax > 0 ? &dwin->lines[dwin->inorgy] : nullptr;
+
     inbuf = dwin->inbuf;
     inoriglen = dwin->inoriglen;
     inarrayrock = dwin->inarrayrock;
@@ -452,12 +578,14 @@ void gcmd_grid_accept_readline(window_t *win, glui32 arg)
 {
     int ix;
     window_textgrid_t *dwin = win->wingrid();
-    tgline_t *ln = &(dwin->lines[dwin->inorgy]);
 
     if (dwin->inbuf == nullptr) {
         return;
     }
 
+    tgline_t *ln = dwin->inmax > 0 ? &dwin->lines[dwin->inorgy] : nullptr;
+    int oldcurs = dwin->incurs, oldlen = dwin->inlen;
+
     if (!win->line_terminators.empty() && gli_window_check_terminator(arg)) {
         if (std::find(win->line_terminators.begin(), win->line_terminators.end(), arg) != win->line_terminators.end()) {
             acceptline(win, arg);
@@ -569,5 +697,10 @@ void gcmd_grid_accept_readline(window_t *win, glui32 arg)
     dwin->curx = dwin->inorgx + dwin->incurs;
     dwin->cury = dwin->inorgy;
 
-    touch(dwin, dwin->inorgy);
+    // Only characters from the cursor on can have changed.
+    if (ln != nullptr) {
+        touch(dwin, dwin->inorgy,
+                dwin->inorgx + std::min(oldcurs, dwin->incurs),
+                dwin->inorgx + std::max(oldlen, dwin->inlen));
+    }
 }
@@ -32,6 +32,7 @@ struct Mask {
     int hor = 0;
     int ver = 0;
     std::vector<std::vector<glui32>> links;
+    rect_t linked; // every non-zero link is inside this
     rect_t select;
 };
 
@@ -67,6 +68,8 @@ void gli_resize_mask(unsigned int x, unsigned int y)
         return;
     }
 
+    gli_mask.linked = rect_t{0, 0, 0, 0};
+
     gli_mask.select.x0 = 0;
     gli_mask.select.y0 = 0;
     gli_mask.select.x1 = 0;
@@ -75,7 +78,7 @@ void gli_resize_mask(unsigned int x, unsigned int y)
 
 void gli_put_hyperlink(glui32 linkval, unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1)
 {
-    int i, k;
+    int i;
     int tx0 = x0 < x1 ? x0 : x1;
     int tx1 = x0 < x1 ? x1 : x0;
     int ty0 = y0 < y1 ? y0 : y1;
@@ -92,11 +95,37 @@ void gli_put_hyperlink(glui32 linkval, unsigned int x0, unsigned int y0, unsigne
         return;
     }
 
-    for (i = tx0; i < tx1; i++) {
-        for (k = ty0; k < ty1; k++) {
-            gli_mask.links[i][k] = linkval;
+    rect_t &linked = gli_mask.linked;
+
+    // Most calls clear links from an area that's being redrawn, and
+    // usually there are none there to clear.
+    if (linkval == 0) {
+        tx0 = std::max(tx0, linked.x0);
+        ty0 = std::max(ty0, linked.y0);
+        tx1 = std::min(tx1, linked.x1);
+        ty1 = std::min(ty1, linked.y1);
+
+        if (tx0 >= tx1 || ty0 >= ty1) {
+            return;
+        }
+
+        if (tx0 == linked.x0 && ty0 == linked.y0 && tx1 == linked.x1 && ty1 == linked.y1) {
+            linked = rect_t{0, 0, 0, 0};
+        }
+    } else if (tx0 < tx1 && ty0 < ty1) {
+        if (linked.x0 >= linked.x1 || linked.y0 >= linked.y1) {
+            linked = rect_t{tx0, ty0, tx1, ty1};
+        } else {
+            linked.x0 = std::min(linked.x0, tx0);
+            linked.y0 = std::min(linked.y0, ty0);
+            linked.x1 = std::max(linked.x1, tx1);
+            linked.y1 = std::max(linked.y1, ty1);
         }
     }
+
+    for (i = tx0; i < tx1; i++) {
+        std::fill(gli_mask.links[i].begin() + ty0, gli_mask.links[i].begin() + ty1, linkval);
+    }
 }
 
 glui32 gli_get_hyperlink(int x, int y)
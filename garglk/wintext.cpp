@@ -21,10 +21,17 @@
 #include <array>
 #include <cstdint>
 #include <cstring>
+#include <iterator>
+#include <list>
 #include <memory>
 #include <new>
+#include <optional>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+#include <zlib.h>
+
 #include "glk.h"
 #include "garglk.h"
 
@@ -39,14 +46,16 @@ static bool
 put_picture(window_textbuffer_t *dwin, const std::shared_ptr<picture_t> &pic, glui32 align, glui32 linkval);
 static void
 scrolloneline(window_textbuffer_t *dwin, bool forced, bool flow_break);
+static void
+put_char(window_textbuffer_t *dwin, glui32 ch);
 
 static void touch(window_textbuffer_t *dwin, int line)
 {
     window_t *win = dwin->owner;
     int y = win->bbox.y0 + gli_tmarginy + (dwin->height - line - 1) * gli_leading;
-    dwin->lines[line].dirty = true;
+    dwin->lines.view(line).dirty = true;
     gli_clear_selection();
-    winrepaint(win->bbox.x0, y - 2, win->bbox.x1, y + gli_leading + 2);
+    gli_repaint_text(win->bbox.x0, y, win->bbox.x1, y + gli_leading);
 }
 
 static void touchscroll(window_textbuffer_t *dwin)
@@ -54,25 +63,325 @@ static void touchscroll(window_textbuffer_t *dwin)
     window_t *win = dwin->owner;
     int i;
     gli_clear_selection();
-    winrepaint(win->bbox.x0, win->bbox.y0, win->bbox.x1, win->bbox.y1);
-    for (i = 0; i < dwin->scrollmax; i++) {
-        dwin->lines[i].dirty = true;
+    gli_repaint_text(win->bbox.x0, win->bbox.y0, win->bbox.x1, win->bbox.y1);
+    for (i = 0; i < dwin->scrollmax && i < dwin->scrollpos + dwin->height; i++) {
+        dwin->lines.view(i).dirty = true;
     }
 }
 
-std::vector<char> gli_get_text(window_textbuffer_t *dwin)
+void tbline_t::store(const glui32 *chars_, const attr_t *attrs_, int len_)
+{
+    len = len_;
+    chars.assign(chars_, chars_ + len_);
+    runs.clear();
+    for (int i = 0; i < len_; i++) {
+        if (runs.empty() || runs.back().attr != attrs_[i]) {
+            runs.push_back(tbrun_t{i, attrs_[i]});
+        }
+    }
+}
+
+void tbline_t::clear_text()
+{
+    len = 0;
+    chars.clear();
+    runs.clear();
+}
+
+const attr_t &tbline_t::attr(int i) const
+{
+    static const attr_t empty;
+
+    auto run = std::upper_bound(runs.begin(), runs.end(), i, [](int pos, const tbrun_t &r) {
+        return pos < r.start;
+    });
+
+    return run == runs.begin() ? empty : std::prev(run)->attr;
+}
+
+template <typename T>
+static void put(std::vector<unsigned char> &out, const T &value)
+{
+    const auto *bytes = reinterpret_cast<const unsigned char *>(&value);
+    out.insert(out.end(), bytes, bytes + sizeof value);
+}
+
+template <typename T>
+static T get(const unsigned char *&in)
+{
+    T value;
+    std::memcpy(&value, in, sizeof value);
+    in += sizeof value;
+    return value;
+}
+
+static void put_color(std::vector<unsigned char> &out, const std::optional<Color> &color)
+{
+    put<unsigned char>(out, color.has_value());
+    if (color.has_value()) {
+        out.insert(out.end(), color->data(), color->data() + 3);
+    }
+}
+
+static std::optional<Color> get_color(const unsigned char *&in)
+{
+    if (get<unsigned char>(in) == 0) {
+        return std::nullopt;
+    }
+
+    Color color(in[0], in[1], in[2]);
+    in += 3;
+    return color;
+}
+
+// Compress a page's lines. Everything but the pictures (which are kept
+// to one side) and the dirty/repaint flags (which only matter for
+// lines on the screen) is stored.
+void TextBufferLines::pack(Page &page)
+{
+    std::vector<unsigned char> raw;
+
+    page.pictures.clear();
+
+    for (std::size_t i = 0; i < page.lines.size(); i++) {
+        const auto &line = page.lines[i];
+
+        put<int>(raw, line.len);
+        put<int>(raw, line.flow_break_pos.value_or(-1));
+        put<unsigned char>(raw, line.newline);
+        put<int>(raw, line.lm);
+        put<int>(raw, line.rm);
+        put<glui32>(raw, line.lhyper);
+        put<glui32>(raw, line.rhyper);
+
+        put<std::uint32_t>(raw, line.runs.size());
+        for (const auto &run : line.runs) {
+            put<int>(raw, run.start);
+            put<unsigned char>(raw, run.attr.reverse);
+            put<glui32>(raw, run.attr.style);
+            put_color(raw, run.attr.fgcolor);
+            put_color(raw, run.attr.bgcolor);
+            put<glui32>(raw, run.attr.hyper);
+        }
+
+        put<std::uint32_t>(raw, line.chars.size());
+        for (auto c : line.chars) {
+            put<glui32>(raw, c);
+        }
+
+        if (line.lpic || line.rpic) {
+            page.pictures.resize(page.lines.size());
+            page.pictures[i] = {line.lpic, line.rpic};
+        }
+    }
+
+    uLongf size = compressBound(raw.size());
+    page.data.resize(size);
+    if (compress2(page.data.data(), &size, raw.data(), raw.size(), Z_BEST_SPEED) != Z_OK) {
+        throw std::bad_alloc();
+    }
+    page.data.resize(size);
+    page.data.shrink_to_fit();
+    page.rawsize = raw.size();
+    page.dirty = false;
+}
+
+// Decompress a page, if it isn't already, and mark it as the most
+// recently used. Only a few pages are kept decompressed at once.
+void TextBufferLines::load(Page &page) const
+{
+    auto resident = std::find(m_resident.begin(), m_resident.end(), &page);
+    if (resident != m_resident.end()) {
+        std::rotate(m_resident.begin(), resident, resident + 1);
+        return;
+    }
+
+    page.lines.resize(page.count);
+
+    if (!page.data.empty()) {
+        std::vector<unsigned char> raw(page.rawsize);
+        uLongf size = raw.size();
+        if (uncompress(raw.data(), &size, page.data.data(), page.data.size()) != Z_OK) {
+            throw std::bad_alloc();
+        }
+
+        const unsigned char *in = raw.data();
+        for (std::size_t i = 0; i < page.count; i++) {
+            auto &line = page.lines[i];
+
+            line.len = get<int>(in);
+            auto flow_break_pos = get<int>(in);
+            if (flow_break_pos != -1) {
+                line.flow_break_pos = flow_break_pos;
+            }
+            line.newline = get<unsigned char>(in) != 0;
+            line.lm = get<int>(in);
+            line.rm = get<int>(in);
+            line.lhyper = get<glui32>(in);
+            line.rhyper = get<glui32>(in);
+
+            line.runs.resize(get<std::uint32_t>(in));
+            for (auto &run : line.runs) {
+                run.start = get<int>(in);
+                run.attr.reverse = get<unsigned char>(in) != 0;
+                run.attr.style = get<glui32>(in);
+                run.attr.fgcolor = get_color(in);
+                run.attr.bgcolor = get_color(in);
+                run.attr.hyper = get<glui32>(in);
+            }
+
+            line.chars.resize(get<std::uint32_t>(in));
+            for (auto &c : line.chars) {
+                c = get<glui32>(in);
+            }
+
+            if (!page.pictures.empty()) {
+                line.lpic = page.pictures[i].first;
+                line.rpic = page.pictures[i].second;
+            }
+        }
+    }
+
+    m_resident.insert(m_resident.begin(), &page);
+    if (m_resident.size() > ResidentPages) {
+        unload(*m_resident.back());
+        m_resident.pop_back();
+    }
+}
+
+void TextBufferLines::unload(Page &page) const
+{
+    if (page.dirty) {
+        pack(page);
+    }
+
+    page.lines.clear();
+    page.lines.shrink_to_fit();
+}
+
+void TextBufferLines::forget(Page &page) const
+{
+    m_resident.erase(std::remove(m_resident.begin(), m_resident.end(), &page), m_resident.end());
+}
+
+// Old line "i", counting from the newest line older than the ring.
+// Since there's no telling what will be done with a line which can be
+// written to, its page is assumed to have been changed.
+tbline_t &TextBufferLines::old_line(std::size_t i, bool write) const
+{
+    if (i < m_open.size()) {
+        return m_open[i];
+    }
+
+    i -= m_open.size();
+    auto &page = m_pages[i / PageLines];
+    load(page);
+    page.dirty = page.dirty || write;
+
+    return page.lines[i % PageLines];
+}
+
+void TextBufferLines::grow(std::size_t n)
+{
+    while (size() < n) {
+        if (m_pages.empty()) {
+            m_open.emplace_back();
+            continue;
+        }
+
+        if (m_pages.back().count == PageLines) {
+            m_pages.emplace_back();
+        }
+
+        auto &page = m_pages.back();
+        load(page);
+        page.lines.emplace_back();
+        page.count++;
+        page.dirty = true;
+        m_paged++;
+    }
+}
+
+void TextBufferLines::scroll(std::size_t n, std::size_t used)
+{
+    n = std::min(n, m_lines.size());
+
+    if (used + n > m_lines.size()) {
+        for (std::size_t i = m_lines.size(); i-- > m_lines.size() - n;) {
+            m_open.push_front(std::move(m_lines[index(i)]));
+        }
+
+        while (m_open.size() > PageLines) {
+            Page page;
+            page.count = PageLines;
+            page.lines.assign(std::make_move_iterator(m_open.end() - PageLines),
+                              std::make_move_iterator(m_open.end()));
+            m_open.erase(m_open.end() - PageLines, m_open.end());
+            pack(page);
+            page.lines.clear();
+            page.lines.shrink_to_fit();
+            m_pages.push_front(std::move(page));
+            m_paged += PageLines;
+        }
+    }
+
+    m_head = m_head >= n ? m_head - n : m_head + m_lines.size() - n;
+}
+
+void TextBufferLines::trim(std::size_t n)
 {
-    int s = dwin->scrollmax < SCROLLBACK ? dwin->scrollmax : SCROLLBACK - 1;
+    while (!m_pages.empty() && size() - m_pages.back().count >= n) {
+        forget(m_pages.back());
+        m_paged -= m_pages.back().count;
+        m_pages.pop_back();
+    }
+}
+
+void TextBufferLines::clear_old()
+{
+    m_open.clear();
+    m_resident.clear();
+    m_pages.clear();
+    m_paged = 0;
+}
+
+// Where run "r" of "ln" ends, when only the first "linelen" characters
+// are being considered.
+static int run_end(const tbline_t &ln, std::size_t r, int linelen)
+{
+    if (r + 1 < ln.runs.size()) {
+        return std::min(ln.runs[r + 1].start, linelen);
+    }
+
+    return linelen;
+}
+
+// Copy the line being edited into lines[0].
+static void store_last_line(window_textbuffer_t *dwin)
+{
+    dwin->lines[0].store(dwin->chars.data(), dwin->attrs.data(), dwin->numchars);
+}
 
+std::vector<char> gli_get_text(window_textbuffer_t *dwin)
+{
     std::vector<char> text;
-    for (int lineidx = s; lineidx >= 0; lineidx--) {
-        auto line = dwin->lines[lineidx];
+    auto put = [&text](glui32 c) {
+        std::array<char, 4> buf;
+        auto n = gli_encode_utf8(c, buf.data(), 4);
+        text.insert(text.end(), buf.data(), buf.data() + n);
+    };
+
+    // History which is waiting to be laid out is older than any line.
+    for (const auto &para : dwin->paragraphs) {
+        for (auto c : para.chars) {
+            put(c);
+        }
+    }
+
+    for (int lineidx = dwin->scrollmax; lineidx >= 0; lineidx--) {
+        const auto &line = std::as_const(dwin->lines)[lineidx];
         for (int charidx = 0; charidx < line.len; charidx++) {
-            std::array<char, 4> buf;
-            auto n = gli_encode_utf8(line.chars[charidx], buf.data(), 4);
-            for (int i = 0; i < n; i++) {
-                text.push_back(buf[i]);
-            }
+            put(line.chars[charidx]);
         }
         // Only add newline if this was an actual paragraph break, not a wrapped line
         if (line.newline) {
@@ -83,121 +392,206 @@ std::vector<char> gli_get_text(window_textbuffer_t *dwin)
     return text;
 }
 
+// Lay out the first "stop" characters of a paragraph, along with its
+// pictures and flow breaks, as they were originally printed.
+static void replay(window_textbuffer_t *dwin, const tbpara_t &para, int stop)
+{
+    window_t *win = dwin->owner;
+    auto picture = para.pictures.begin();
+    auto flow_break = para.flow_breaks.begin();
+
+    auto place = [&](int i) {
+        while (picture != para.pictures.end() && picture->pos == i) {
+            put_picture(dwin, picture->pic, picture->align, picture->hyper);
+            ++picture;
+        }
+
+        while (flow_break != para.flow_breaks.end() && *flow_break == i) {
+            scrolloneline(dwin, false, true);
+            ++flow_break;
+        }
+    };
+
+    for (std::size_t r = 0; r < para.runs.size() && para.runs[r].start < stop; r++) {
+        int end = r + 1 < para.runs.size() ? para.runs[r + 1].start : static_cast<int>(para.chars.size());
+        win->attr = para.runs[r].attr;
+        for (int i = para.runs[r].start; i < end && i < stop; i++) {
+            place(i);
+            put_char(dwin, para.chars[i]);
+        }
+    }
+
+    if (stop == static_cast<int>(para.chars.size())) {
+        place(stop);
+    }
+}
+
+// Return where to start laying out the paragraphs before "end" in order
+// to get roughly "lines" lines from them. Layout can only start after a
+// paragraph which no margin picture extends beyond.
+static std::size_t chunk_start(const window_textbuffer_t *dwin, const std::vector<tbpara_t> &paras, std::size_t end, int lines)
+{
+    int width = std::max(dwin->width, 1);
+    std::size_t start = end;
+
+    while (start > 0 && lines > 0) {
+        start--;
+        lines -= 1 + static_cast<int>(paras[start].chars.size()) / width;
+    }
+
+    while (start > 0 && paras[start - 1].margin_lines != 0) {
+        start--;
+    }
+
+    return start;
+}
+
+// Lay out history waiting in "paragraphs", a chunk at a time, until
+// there are at least "lines" lines of scrollback or there is no more.
+void win_textbuffer_reflow_history(window_textbuffer_t *dwin, int lines)
+{
+    window_t *win = dwin->owner;
+    auto &paras = dwin->paragraphs;
+
+    if (paras.empty() || dwin->scrollmax >= lines) {
+        return;
+    }
+
+    attr_t oldattr = win->attr;
+
+    while (!paras.empty() && dwin->scrollmax < lines) {
+        auto start = chunk_start(dwin, paras, paras.size(), std::max(lines - dwin->scrollmax, dwin->height));
+
+        // Lay the chunk out in a window of its own, which starts out
+        // just as this one would have when the chunk was reached...
+        window_textbuffer_t scratch(win);
+        scratch.width = dwin->width;
+        scratch.height = 0;
+        scratch.scrollback = 0;
+        scratch.styles = dwin->styles;
+
+        for (auto para = paras.begin() + start; para != paras.end(); ++para) {
+            replay(&scratch, *para, para->chars.size());
+        }
+
+        paras.erase(paras.begin() + start, paras.end());
+
+        // ...then move its lines to the old end of this window's
+        // scrollback. Every paragraph ends in a newline, so the
+        // scratch window's last line is empty and isn't wanted.
+        int n = scratch.scrollmax;
+        dwin->lines.grow(dwin->scrollmax + n + 2);
+
+        for (int i = 1; i <= n; i++) {
+            auto &line = dwin->lines[dwin->scrollmax + i];
+            line = std::move(scratch.lines[i]);
+            line.dirty = true;
+        }
+
+        dwin->scrollmax += n;
+
+        // Anything older than the window keeps is of no use.
+        if (dwin->scrollback != 0 && dwin->scrollmax >= dwin->scrollback) {
+            dwin->scrollmax = dwin->scrollback;
+            dwin->lines.trim(dwin->scrollback + 1);
+            paras.clear();
+        }
+    }
+
+    win->attr = oldattr;
+
+    touchscroll(dwin);
+}
+
+// Lay out the window's text again at a new width. Only enough of the
+// most recent text to fill the window is laid out now: the rest is
+// kept as paragraphs, and laid out as it's scrolled into view.
 static void reflow(window_t *win)
 {
     window_textbuffer_t *dwin = win->winbuffer();
     int inputbyte = -1;
     attr_t curattr;
     attr_t oldattr;
-    int i, k, p, s;
-    int x, f;
+    int k;
 
     if (dwin->height < 4 || dwin->width < 20) {
         return;
     }
 
-    dwin->lines[0].len = dwin->numchars;
-
-    std::vector<attr_t> attrbuf;
-    std::vector<glui32> charbuf;
-    std::vector<int> alignbuf;
-    std::vector<std::shared_ptr<picture_t>> pictbuf;
-    std::vector<glui32> hyperbuf;
-    std::vector<int> offsetbuf;
-    std::vector<int> flowbreakbuf;
-
-    // allocate temp buffers
-    try {
-        attrbuf.resize(SCROLLBACK * TBLINELEN);
-        charbuf.resize(SCROLLBACK * TBLINELEN);
-        alignbuf.resize(SCROLLBACK);
-        pictbuf.resize(SCROLLBACK);
-        hyperbuf.resize(SCROLLBACK);
-        offsetbuf.resize(SCROLLBACK);
-        flowbreakbuf.resize(SCROLLBACK);
-    } catch (const std::bad_alloc &) {
-        return;
-    }
+    store_last_line(dwin);
 
-    // copy text to temp buffers
+    // turn the laid out lines back into paragraphs, following any
+    // older history which never got laid out at the previous width
 
     oldattr = win->attr;
     curattr.clear();
 
-    x = 0;
-    f = 0;
-    p = 0;
-    s = dwin->scrollmax < SCROLLBACK ? dwin->scrollmax : SCROLLBACK - 1;
+    auto paras = std::move(dwin->paragraphs);
+
+    tbpara_t para;
+    int margin_lines = paras.empty() ? 0 : paras.back().margin_lines;
+
+    for (k = dwin->scrollmax; k >= 0; k--) {
+        const auto &line = std::as_const(dwin->lines)[k];
+        int p = para.chars.size();
 
-    for (k = s; k >= 0; k--) {
         if (k == 0 && win->line_request) {
             inputbyte = p + dwin->infence;
         }
 
-        if (dwin->lines[k].lpic) {
-            offsetbuf[x] = p;
-            alignbuf[x] = imagealign_MarginLeft;
-            pictbuf[x] = dwin->lines[k].lpic;
-            hyperbuf[x] = dwin->lines[k].lhyper;
-            x++;
+        if (line.lpic) {
+            para.pictures.push_back({p, imagealign_MarginLeft, line.lpic, line.lhyper});
+            margin_lines = std::max(margin_lines, (line.lpic->h + gli_cellh - 1) / gli_cellh);
         }
 
-        if (dwin->lines[k].rpic) {
-            offsetbuf[x] = p;
-            alignbuf[x] = imagealign_MarginRight;
-            pictbuf[x] = dwin->lines[k].rpic;
-            hyperbuf[x] = dwin->lines[k].rhyper;
-            x++;
+        if (line.rpic) {
+            para.pictures.push_back({p, imagealign_MarginRight, line.rpic, line.rhyper});
+            margin_lines = std::max(margin_lines, (line.rpic->h + gli_cellh - 1) / gli_cellh);
         }
 
-        auto flow_break_pos = dwin->lines[k].flow_break_pos;
-        if (flow_break_pos.has_value()) {
-            flowbreakbuf[f] = p + *flow_break_pos;
-            f++;
+        if (line.flow_break_pos.has_value()) {
+            para.flow_breaks.push_back(p + *line.flow_break_pos);
         }
 
-        for (i = 0; i < dwin->lines[k].len; i++) {
-            attrbuf[p] = curattr = dwin->lines[k].attrs[i];
-            charbuf[p] = dwin->lines[k].chars[i];
-            p++;
+        for (const auto &run : line.runs) {
+            if (para.runs.empty() || para.runs.back().attr != run.attr) {
+                para.runs.push_back(tbrun_t{p + run.start, run.attr});
+            }
+            curattr = run.attr;
         }
+        para.chars.insert(para.chars.end(), line.chars.begin(), line.chars.begin() + line.len);
+
+        if (line.newline) {
+            if (para.runs.empty() || para.runs.back().attr != curattr) {
+                para.runs.push_back(tbrun_t{static_cast<int>(para.chars.size()), curattr});
+            }
+            para.chars.push_back('\n');
+
+            // each paragraph takes up at least one line
+            margin_lines = std::max(margin_lines - 1, 0);
+            para.margin_lines = margin_lines;
 
-        if (dwin->lines[k].newline) {
-            attrbuf[p] = curattr;
-            charbuf[p] = '\n';
-            p++;
+            paras.push_back(std::move(para));
+            para = tbpara_t();
         }
     }
 
-    offsetbuf[x] = -1;
-    flowbreakbuf[f] = -1;
-
     // clear window
 
     win_textbuffer_clear(win);
 
-    // and dump text back
+    // and dump the most recent text back
 
-    x = 0;
-    f = 0;
-    for (i = 0; i < p; i++) {
-        if (i == inputbyte) {
-            break;
-        }
-        win->attr = attrbuf[i];
+    int rows = (win->bbox.y1 - win->bbox.y0 - gli_tmarginy * 2) / gli_cellh;
+    auto start = chunk_start(dwin, paras, paras.size(), rows);
 
-        if (offsetbuf[x] == i) {
-            put_picture(dwin, pictbuf[x], alignbuf[x], hyperbuf[x]);
-            x++;
-        }
+    for (auto it = paras.begin() + start; it != paras.end(); ++it) {
+        replay(dwin, *it, it->chars.size());
+    }
 
-        if (flowbreakbuf[f] == i) {
-            scrolloneline(dwin, false, true);
-            f++;
-        }
+    paras.erase(paras.begin() + start, paras.end());
 
-        win_textbuffer_putchar_uni(win, charbuf[i]);
-    }
+    replay(dwin, para, inputbyte != -1 ? inputbyte : para.chars.size());
 
     // terribly sorry about this...
     dwin->lastseen = 0;
@@ -205,12 +599,17 @@ static void reflow(window_t *win)
 
     if (inputbyte != -1) {
         dwin->infence = dwin->numchars;
-        put_text_uni(dwin, charbuf.data() + inputbyte, p - inputbyte, dwin->numchars, 0);
+        put_text_uni(dwin, para.chars.data() + inputbyte, para.chars.size() - inputbyte, dwin->numchars, 0);
         dwin->incurs = dwin->numchars;
     }
 
     win->attr = oldattr;
 
+    // Keep a screenful of history above what's visible laid out, so
+    // that paging up doesn't have to wait for it.
+    dwin->paragraphs = std::move(paras);
+    win_textbuffer_reflow_history(dwin, rows * 2);
+
     touchscroll(dwin);
 }
 
@@ -243,6 +642,8 @@ void win_textbuffer_rearrange(window_t *win, rect_t *box)
 
         dwin->height = newhgt;
 
+        win_textbuffer_reflow_history(dwin, dwin->scrollpos + dwin->height);
+
         // keep window within 'valid' lines
         if (dwin->scrollpos > dwin->scrollmax - dwin->height + 1) {
             dwin->scrollpos = dwin->scrollmax - dwin->height + 1;
@@ -285,6 +686,84 @@ static int calcwidth(window_textbuffer_t *dwin,
     return calcwidth(dwin, chars.data(), attrs.data(), startchar, numchars, spw);
 }
 
+// As above, but for a stored line, measuring a run at a time.
+static int calcwidth(window_textbuffer_t *dwin, const tbline_t &ln,
+    int startchar, int numchars, int spw)
+{
+    int w = 0;
+
+    for (std::size_t r = 0; r < ln.runs.size() && ln.runs[r].start < numchars; r++) {
+        int a = std::max(ln.runs[r].start, startchar);
+        int b = run_end(ln, r, numchars);
+        if (a < b) {
+            w += gli_string_width_uni(ln.runs[r].attr.font(dwin->styles),
+                    &ln.chars[a], b - a, spw);
+        }
+    }
+
+    return w;
+}
+
+// Find where each of the first "linelen" characters of "ln" is drawn,
+// relative to the start of the line, followed by where the line ends.
+// Each run is measured once (and the measurement is cached along with
+// its text), so finding a character by position is linear in the
+// length of the line rather than quadratic.
+static void glyph_offsets(window_textbuffer_t *dwin, const tbline_t &ln,
+    int linelen, int spw, std::vector<int> &offsets)
+{
+    int x = 0;
+
+    offsets.clear();
+
+    for (std::size_t r = 0; r < ln.runs.size() && ln.runs[r].start < linelen; r++) {
+        int a = ln.runs[r].start;
+        int b = run_end(ln, r, linelen);
+        const auto &run = gli_string_measure_uni(ln.runs[r].attr.font(dwin->styles),
+                &ln.chars[a], b - a, spw);
+        for (auto offset : run.offsets) {
+            offsets.push_back(x + offset);
+        }
+        x += run.width;
+    }
+
+    offsets.push_back(x);
+}
+
+// Flip the reverse attribute of characters "start" through "end" - 1
+// of "ln", splitting its runs where needed.
+static void reverse_chars(tbline_t &ln, int start, int end)
+{
+    auto split = [&ln](int pos) {
+        if (pos >= ln.len) {
+            return;
+        }
+
+        auto run = std::upper_bound(ln.runs.begin(), ln.runs.end(), pos, [](int p, const tbrun_t &r) {
+            return p < r.start;
+        });
+        if (run != ln.runs.begin() && std::prev(run)->start != pos) {
+            ln.runs.insert(run, tbrun_t{pos, std::prev(run)->attr});
+        }
+    };
+
+    split(start);
+    split(end);
+
+    for (auto &run : ln.runs) {
+        if (run.start >= start && run.start < end) {
+            run.attr.reverse = !run.attr.reverse;
+        }
+    }
+
+    // Merge runs which have become identical, so that text is measured
+    // and drawn in the same pieces as if it had been stored this way.
+    auto same = [](const tbrun_t &a, const tbrun_t &b) {
+        return !(a.attr != b.attr);
+    };
+    ln.runs.erase(std::unique(ln.runs.begin(), ln.runs.end(), same), ln.runs.end());
+}
+
 // Horizontal origin for a line's text, honoring Justification stylehints.
 static int line_text_x0(window_textbuffer_t *dwin, const tbline_t &ln,
     int linelen, int x0, int x1, int spw)
@@ -295,12 +774,12 @@ static int line_text_x0(window_textbuffer_t *dwin, const tbline_t &ln,
         return text_x0;
     }
 
-    glui32 just = dwin->styles[ln.attrs[0].style].justification;
+    glui32 just = dwin->styles[ln.attr(0).style].justification;
     if (just != stylehint_just_Centered && just != stylehint_just_RightFlush) {
         return text_x0;
     }
 
-    int textw = calcwidth(dwin, ln.chars, ln.attrs, 0, linelen, spw);
+    int textw = calcwidth(dwin, ln, 0, linelen, spw);
     int avail = x1 - x0 - ln.lm - ln.rm - 2 * SLOP;
     if (textw >= avail) {
         return text_x0;
@@ -313,10 +792,172 @@ static int line_text_x0(window_textbuffer_t *dwin, const tbline_t &ln,
     return text_x0 + (avail - textw);
 }
 
+// Text buffer lines as they were last drawn, so that a line which is
+// drawn again unchanged (as every line on the screen is when the window
+// is scrolled) is copied into the framebuffer instead of being drawn
+// glyph by glyph. Lines are keyed on everything that goes into drawing
+// them: their width and indentation, the background, and the text, font
+// and colors of each run. The least recently used lines are dropped
+// once the total size exceeds gli_conf_line_cache_size, and a size of 0
+// turns the cache off.
+class LineCache {
+public:
+    using Key = std::vector<glui32>;
+
+    const std::vector<unsigned char> *find(const Key &key);
+    void insert(const Key &key, std::vector<unsigned char> pixels);
+    garglk::CacheStats stats() const;
+
+private:
+    struct Entry {
+        std::size_t hash;
+        Key key;
+        std::vector<unsigned char> pixels;
+
+        std::size_t size() const {
+            return sizeof(Entry) + key.size() * sizeof(glui32) + pixels.size();
+        }
+    };
+
+    static std::size_t hash(const Key &key);
+
+    // Most recently used first.
+    std::list<Entry> m_lru;
+    std::unordered_map<std::size_t, std::list<Entry>::iterator> m_entries;
+    std::size_t m_bytes = 0;
+    garglk::CacheStats m_stats;
+};
+
+static LineCache line_cache;
+
+std::size_t LineCache::hash(const Key &key)
+{
+    std::size_t h = 0;
+
+    for (auto word : key) {
+        h = hash_combine(h, word);
+    }
+
+    return h;
+}
+
+// Entries are indexed by hash alone. If two lines collide, the newer
+// one replaces the older, so a lookup has to compare the full key.
+const std::vector<unsigned char> *LineCache::find(const Key &key)
+{
+    auto it = m_entries.find(hash(key));
+    if (it == m_entries.end() || it->second->key != key) {
+        m_stats.misses++;
+        return nullptr;
+    }
+
+    m_stats.hits++;
+    m_lru.splice(m_lru.begin(), m_lru, it->second);
+
+    return &it->second->pixels;
+}
+
+void LineCache::insert(const Key &key, std::vector<unsigned char> pixels)
+{
+    auto h = hash(key);
+
+    auto old = m_entries.find(h);
+    if (old != m_entries.end()) {
+        m_bytes -= old->second->size();
+        m_lru.erase(old->second);
+        m_entries.erase(old);
+    }
+
+    m_lru.push_front(Entry{h, key, std::move(pixels)});
+    m_entries[h] = m_lru.begin();
+    m_bytes += m_lru.front().size();
+
+    while (m_bytes > gli_conf_line_cache_size && !m_lru.empty()) {
+        const auto &lru = m_lru.back();
+        m_bytes -= lru.size();
+        m_entries.erase(lru.hash);
+        m_lru.pop_back();
+        m_stats.evictions++;
+    }
+}
+
+garglk::CacheStats LineCache::stats() const
+{
+    auto stats = m_stats;
+    stats.entries = m_lru.size();
+    stats.bytes = m_bytes;
+    stats.capacity = gli_conf_line_cache_size;
+
+    return stats;
+}
+
+garglk::CacheStats garglk::line_cache_stats()
+{
+    return line_cache.stats();
+}
+
+// Build the line cache key for the first "linelen" characters of "ln",
+// drawn "indent" subpixels into a line "width" subpixels wide.
+static void line_key(window_textbuffer_t *dwin, const tbline_t &ln,
+    int linelen, int spw, int width, int indent, const Color &bg, LineCache::Key &key)
+{
+    auto pack = [](const Color &color) {
+        return (static_cast<glui32>(color[0]) << 16) | (static_cast<glui32>(color[1]) << 8) | color[2];
+    };
+
+    key.assign({
+        static_cast<glui32>(width),
+        static_cast<glui32>(indent),
+        static_cast<glui32>(spw),
+        pack(bg),
+    });
+
+    for (std::size_t r = 0; r < ln.runs.size() && ln.runs[r].start < linelen; r++) {
+        const attr_t &attr = ln.runs[r].attr;
+        FontFace face = attr.font(dwin->styles);
+        key.push_back(static_cast<glui32>(run_end(ln, r, linelen)));
+        key.push_back((face.monospace ? 4 : 0) | (face.bold ? 2 : 0) | (face.italic ? 1 : 0));
+        key.push_back(pack(attr.hyper != 0 ? gli_link_color : attr.fg(dwin->styles)));
+        key.push_back(pack(attr.bg(dwin->styles)));
+        key.push_back(attr.hyper != 0);
+    }
+
+    key.insert(key.end(), ln.chars.begin(), ln.chars.begin() + linelen);
+}
+
+static unsigned char *framebuffer_at(int x, int y)
+{
+    return gli_image_rgb.data() + y * gli_image_rgb.stride() + x * garglk::FramebufferLayout::size;
+}
+
+// Copy a line's pixels out of the framebuffer, or back into it. The
+// line is "w" pixels wide and gli_leading tall, with its top left
+// corner at ("x", "y").
+static std::vector<unsigned char> get_line_pixels(int x, int y, int w)
+{
+    std::size_t rowsize = w * garglk::FramebufferLayout::size;
+    std::vector<unsigned char> pixels(rowsize * gli_leading);
+
+    for (int row = 0; row < gli_leading; row++) {
+        std::memcpy(&pixels[row * rowsize], framebuffer_at(x, y + row), rowsize);
+    }
+
+    return pixels;
+}
+
+static void put_line_pixels(const std::vector<unsigned char> &pixels, int x, int y, int w)
+{
+    std::size_t rowsize = w * garglk::FramebufferLayout::size;
+
+    for (int row = 0; row < gli_leading; row++) {
+        std::memcpy(framebuffer_at(x, y + row), &pixels[row * rowsize], rowsize);
+    }
+}
+
 void win_textbuffer_redraw(window_t *win)
 {
     window_textbuffer_t *dwin = win->winbuffer();
-    tbline_t ln;
+    tbline_t selected; // a copy of a line, with its selected text reversed
     int linelen;
     int nsp, spw, pw;
     int x0, y0, x1, y1;
@@ -331,8 +972,10 @@ void win_textbuffer_redraw(window_t *win)
     int sx0 = 0, sx1 = 0;
     bool selleft = false, selright = false;
     int tx, tsc, tsw, lsc, rsc;
+    std::vector<int> offsets;
+    LineCache::Key key;
 
-    dwin->lines[0].len = dwin->numchars;
+    store_last_line(dwin);
 
     x0 = (win->bbox.x0 + gli_tmarginx) * GLI_SUBPIX;
     x1 = (win->bbox.x1 - gli_tmarginx - gli_scroll_width) * GLI_SUBPIX;
@@ -364,27 +1007,30 @@ void win_textbuffer_redraw(window_t *win)
 
         // mark selected line dirty
         if (selrow) {
-            dwin->lines[i].dirty = true;
+            dwin->lines.view(i).dirty = true;
         }
 
-        ln = dwin->lines[i];
+        // Lines are read in place; only a line with a selection in it is
+        // copied, so that its selected characters can be reversed.
+        const tbline_t &ln = std::as_const(dwin->lines)[i];
+        const tbline_t *shown = &ln;
 
         // skip if we can
         if (!ln.dirty && !ln.repaint && !gli_force_redraw && dwin->scrollpos == 0) {
             continue;
         }
 
-        // repaint previously selected lines if needed
-        if (ln.repaint && !gli_force_redraw) {
+        // repaint selected and previously selected lines if needed
+        if ((ln.repaint || selrow) && !gli_force_redraw) {
             gli_redraw_rect(x0 / GLI_SUBPIX, y, x1 / GLI_SUBPIX, y + gli_leading);
         }
 
         // keep selected line dirty and flag for repaint
         if (!selrow) {
-            dwin->lines[i].dirty = false;
-            dwin->lines[i].repaint = false;
+            dwin->lines.view(i).dirty = false;
+            dwin->lines.view(i).repaint = false;
         } else {
-            dwin->lines[i].repaint = true;
+            dwin->lines.view(i).repaint = true;
         }
 
         // leave bottom line blank for [more] prompt
@@ -397,19 +1043,22 @@ void win_textbuffer_redraw(window_t *win)
         // kill spaces at the end unless they're a different color
         Color color = gli_override_bg.has_value() ? gli_window_color : win->bgcolor;
         while (i > 0 && linelen > 1 && ln.chars[linelen - 1] == ' '
-                && ln.attrs[linelen - 1].bgcolor == color
-                && !ln.attrs[linelen - 1].reverse) {
+                && ln.attr(linelen - 1).bgcolor == color
+                && !ln.attr(linelen - 1).reverse) {
             linelen--;
         }
 
         // kill characters that would overwrite the scroll bar
-        while (linelen > 1 && calcwidth(dwin, ln.chars, ln.attrs, 0, linelen, -1) >= pw) {
-            linelen--;
+        if (linelen > 1 && calcwidth(dwin, ln, 0, linelen, -1) >= pw) {
+            glyph_offsets(dwin, ln, linelen, -1, offsets);
+            while (linelen > 1 && offsets[linelen] >= pw) {
+                linelen--;
+            }
         }
 
         // count spaces and width for full (left-right) justification
         glui32 line_just = linelen > 0
-            ? dwin->styles[ln.attrs[0].style].justification
+            ? dwin->styles[ln.attr(0).style].justification
             : stylehint_just_LeftFlush;
         bool full_justify = (gli_conf_justify || line_just == stylehint_just_LeftRight)
             && line_just != stylehint_just_Centered
@@ -421,7 +1070,7 @@ void win_textbuffer_redraw(window_t *win)
                     nsp++;
                 }
             }
-            w = calcwidth(dwin, ln.chars, ln.attrs, 0, linelen, 0);
+            w = calcwidth(dwin, ln, 0, linelen, 0);
             if (nsp != 0) {
                 spw = (x1 - x0 - ln.lm - ln.rm - 2 * SLOP - w) / nsp;
             } else {
@@ -438,21 +1087,22 @@ void win_textbuffer_redraw(window_t *win)
             lsc = 0;
             rsc = 0;
             selchar = false;
+            glyph_offsets(dwin, ln, linelen, spw, offsets);
             // optimized case for all chars selected
             if (selleft && selright) {
                 rsc = linelen > 0 ? linelen - 1 : 0;
-                selchar = ((calcwidth(dwin, ln.chars, ln.attrs, lsc, rsc, spw) / GLI_SUBPIX) != 0);
+                selchar = (((offsets[rsc] - offsets[lsc]) / GLI_SUBPIX) != 0);
             } else {
                 // optimized case for leftmost char selected
                 if (selleft) {
                     tsc = linelen > 0 ? linelen - 1 : 0;
-                    selchar = ((calcwidth(dwin, ln.chars, ln.attrs, lsc, tsc, spw) / GLI_SUBPIX) != 0);
+                    selchar = (((offsets[tsc] - offsets[lsc]) / GLI_SUBPIX) != 0);
                 } else {
                     // find the substring contained by the selection
                     tx = text_x0 / GLI_SUBPIX;
-                    // measure string widths until we find left char
+                    // find the first character at or past the left edge
                     for (tsc = 0; tsc < linelen; tsc++) {
-                        tsw = calcwidth(dwin, ln.chars, ln.attrs, 0, tsc, spw) / GLI_SUBPIX;
+                        tsw = offsets[tsc] / GLI_SUBPIX;
                         if (tsw + tx >= sx0 ||
                                 (tsw + tx + GLI_SUBPIX >= sx0 && ln.chars[tsc] != ' ')) {
                             lsc = tsc;
@@ -466,9 +1116,9 @@ void win_textbuffer_redraw(window_t *win)
                     if (selright) {
                         rsc = linelen > 0 ? linelen - 1 : 0;
                     } else {
-                        // measure string widths until we find right char
+                        // find the last character before the right edge
                         for (tsc = lsc; tsc < linelen; tsc++) {
-                            tsw = calcwidth(dwin, ln.chars, ln.attrs, lsc, tsc, spw) / GLI_SUBPIX;
+                            tsw = (offsets[tsc] - offsets[lsc]) / GLI_SUBPIX;
                             if (tsw + sx0 < sx1) {
                                 rsc = tsc;
                             }
@@ -481,8 +1131,10 @@ void win_textbuffer_redraw(window_t *win)
             }
             // reverse colors for selected chars
             if (selchar) {
+                selected = ln;
+                reverse_chars(selected, lsc, rsc + 1);
+                shown = &selected;
                 for (tsc = lsc; tsc <= rsc; tsc++) {
-                    ln.attrs[tsc].reverse = !ln.attrs[tsc].reverse;
                     dwin->copybuf.push_back(ln.chars[tsc]);
                 }
             }
@@ -496,54 +1148,79 @@ void win_textbuffer_redraw(window_t *win)
         gli_put_hyperlink(0, x0 / GLI_SUBPIX, y,
                 x1 / GLI_SUBPIX, y + gli_leading);
 
-        // fill in background colors
+        // Copy the line from the line cache if it's there. Lines with a
+        // selection or the caret in them are always drawn.
+        bool caret = gli_focuswin == win && i == 0 && (win->line_request || win->line_request_uni);
+        bool cacheable = gli_conf_line_cache_size != 0 && shown == &ln && !caret &&
+            x0 >= 0 && x1 / GLI_SUBPIX <= gli_image_rgb.width() &&
+            y >= 0 && y + gli_leading <= gli_image_rgb.height();
+        const std::vector<unsigned char> *cached = nullptr;
+
+        // Everything drawn for the line, which has to stay inside the line
+        // for the line to be cached: a glyph or underline reaching into
+        // its neighbours wouldn't be copied along with it.
+        rect_t ink{x0 / GLI_SUBPIX, y, x1 / GLI_SUBPIX, y + gli_leading};
+
         color = gli_override_bg.has_value() ? gli_window_color : win->bgcolor;
-        gli_draw_rect(x0 / GLI_SUBPIX, y,
-                (x1 - x0) / GLI_SUBPIX, gli_leading,
+
+        // A glyph at either end of the line can reach into the window's
+        // margins, so clear the line's part of them too, or what it
+        // leaves there outlives the line.
+        gli_draw_rect(win->bbox.x0, y,
+                x0 / GLI_SUBPIX - win->bbox.x0, gli_leading,
+                color);
+        gli_draw_rect(x1 / GLI_SUBPIX, y,
+                win->bbox.x1 - gli_scroll_width - x1 / GLI_SUBPIX, gli_leading,
                 color);
 
+        if (cacheable) {
+            line_key(dwin, ln, linelen, spw, x1 - x0, text_x0 - x0, color, key);
+            cached = line_cache.find(key);
+            if (cached != nullptr) {
+                put_line_pixels(*cached, x0 / GLI_SUBPIX, y, (x1 - x0) / GLI_SUBPIX);
+            }
+        }
+
+        // fill in background colors
+        if (cached == nullptr) {
+            gli_draw_rect(x0 / GLI_SUBPIX, y,
+                    (x1 - x0) / GLI_SUBPIX, gli_leading,
+                    color);
+        }
+
         x = text_x0;
-        a = 0;
-        for (b = 0; b < linelen; b++) {
-            if (ln.attrs[a] != ln.attrs[b]) {
-                link = ln.attrs[a].hyper;
-                auto font = ln.attrs[a].font(dwin->styles);
-                color = ln.attrs[a].bg(dwin->styles);
-                w = gli_string_width_uni(font, &ln.chars[a], b - a, spw);
+        for (std::size_t r = 0; r < shown->runs.size() && shown->runs[r].start < linelen; r++) {
+            const attr_t &attr = shown->runs[r].attr;
+            a = shown->runs[r].start;
+            b = run_end(*shown, r, linelen);
+            link = attr.hyper;
+            color = attr.bg(dwin->styles);
+            w = gli_string_width_uni(attr.font(dwin->styles), &shown->chars[a], b - a, spw);
+            if (cached == nullptr) {
                 gli_draw_rect(x / GLI_SUBPIX, y,
                         w / GLI_SUBPIX, gli_leading,
                         color);
-                if (link != 0) {
-                    if (gli_underline_hyperlinks) {
-                        gli_draw_rect(x / GLI_SUBPIX + 1, y + gli_baseline + 1,
-                                w / GLI_SUBPIX + 1, 1,
-                                gli_link_color);
-                    }
-                    gli_put_hyperlink(link, x / GLI_SUBPIX, y,
-                            x / GLI_SUBPIX + w / GLI_SUBPIX,
-                            y + gli_leading);
+                ink.x0 = std::min(ink.x0, x / GLI_SUBPIX);
+                ink.x1 = std::max(ink.x1, x / GLI_SUBPIX + w / GLI_SUBPIX);
+            }
+            if (link != 0) {
+                if (gli_underline_hyperlinks && cached == nullptr) {
+                    gli_draw_rect(x / GLI_SUBPIX + 1, y + gli_baseline + 1,
+                            w / GLI_SUBPIX + 1, 1,
+                            gli_link_color);
+                    ink.x1 = std::max(ink.x1, x / GLI_SUBPIX + w / GLI_SUBPIX + 2);
+                    ink.y1 = std::max(ink.y1, y + gli_baseline + 2);
                 }
-                x += w;
-                a = b;
+                gli_put_hyperlink(link, x / GLI_SUBPIX, y,
+                        x / GLI_SUBPIX + w / GLI_SUBPIX,
+                        y + gli_leading);
             }
+            x += w;
         }
-        link = ln.attrs[a].hyper;
-        auto font = ln.attrs[a].font(dwin->styles);
-        color = ln.attrs[a].bg(dwin->styles);
-        w = gli_string_width_uni(font, &ln.chars[a], b - a, spw);
-        gli_draw_rect(x / GLI_SUBPIX, y, w / GLI_SUBPIX,
-                gli_leading, color);
-        if (link != 0) {
-            if (gli_underline_hyperlinks) {
-                gli_draw_rect(x / GLI_SUBPIX + 1, y + gli_baseline + 1,
-                        w / GLI_SUBPIX + 1, 1,
-                        gli_link_color);
-            }
-            gli_put_hyperlink(link, x / GLI_SUBPIX, y,
-                    x / GLI_SUBPIX + w / GLI_SUBPIX,
-                    y + gli_leading);
+
+        if (cached != nullptr) {
+            continue;
         }
-        x += w;
 
         color = gli_override_bg.has_value() ? gli_window_color : win->bgcolor;
         gli_draw_rect(x / GLI_SUBPIX, y,
@@ -554,7 +1231,7 @@ void win_textbuffer_redraw(window_t *win)
         // draw caret
         //
 
-        if (gli_focuswin == win && i == 0 && (win->line_request || win->line_request_uni)) {
+        if (caret) {
             w = calcwidth(dwin, dwin->chars, dwin->attrs, 0, dwin->incurs, spw);
             if (w < pw - gli_caret_shape * 2 * GLI_SUBPIX) {
                 gli_draw_caret(text_x0 + w, y + gli_baseline);
@@ -566,22 +1243,30 @@ void win_textbuffer_redraw(window_t *win)
         //
 
         x = text_x0;
-        a = 0;
-        for (b = 0; b < linelen; b++) {
-            if (ln.attrs[a] != ln.attrs[b]) {
-                link = ln.attrs[a].hyper;
-                font = ln.attrs[a].font(dwin->styles);
-                color = link != 0 ? gli_link_color : ln.attrs[a].fg(dwin->styles);
-                x = gli_draw_string_uni(x, y + gli_baseline,
-                        font, color, &ln.chars[a], b - a, spw);
-                a = b;
-            }
+        for (std::size_t r = 0; r < shown->runs.size() && shown->runs[r].start < linelen; r++) {
+            const attr_t &attr = shown->runs[r].attr;
+            a = shown->runs[r].start;
+            b = run_end(*shown, r, linelen);
+            link = attr.hyper;
+            color = link != 0 ? gli_link_color : attr.fg(dwin->styles);
+            x = gli_draw_string_uni(x, y + gli_baseline,
+                    attr.font(dwin->styles), color, &shown->chars[a], b - a, spw, &ink);
+        }
+
+        bool inside = ink.x0 >= x0 / GLI_SUBPIX && ink.y0 >= y &&
+            ink.x1 <= x1 / GLI_SUBPIX && ink.y1 <= y + gli_leading;
+
+        if (cacheable && inside) {
+            line_cache.insert(key, get_line_pixels(x0 / GLI_SUBPIX, y, (x1 - x0) / GLI_SUBPIX));
+        }
+
+        // Glyphs reaching out of the line (a tall accent, say) are drawn
+        // over its neighbours, which may not be repainted, and each time
+        // the line is drawn they're blended in again. Damage everything
+        // they touched.
+        if (!inside && !gli_force_redraw) {
+            winrepaint(ink.x0, ink.y0, ink.x1, ink.y1);
         }
-        link = ln.attrs[a].hyper;
-        font = ln.attrs[a].font(dwin->styles);
-        color = link != 0 ? gli_link_color : ln.attrs[a].fg(dwin->styles);
-        gli_draw_string_uni(x, y + gli_baseline,
-                font, color, &ln.chars[a], linelen - a, spw);
     }
 
     //
@@ -595,9 +1280,11 @@ void win_textbuffer_redraw(window_t *win)
         gli_put_hyperlink(0, x0 / GLI_SUBPIX, y,
                 x1/GLI_SUBPIX, y + gli_leading);
 
+        // Clear from the margin, not where the prompt starts, since its
+        // first glyph can reach to the left of that.
         Color color = gli_override_bg.has_value() ? gli_window_color : win->bgcolor;
-        gli_draw_rect(x / GLI_SUBPIX, y,
-                x1 / GLI_SUBPIX - x / GLI_SUBPIX, gli_leading,
+        gli_draw_rect(x0 / GLI_SUBPIX, y,
+                x1 / GLI_SUBPIX - x0 / GLI_SUBPIX, gli_leading,
                 color);
 
         w = gli_string_width_uni(gli_more_font,
@@ -627,8 +1314,12 @@ void win_textbuffer_redraw(window_t *win)
     // draw the images
     //
 
-    for (i = 0; i < dwin->scrollback; i++) {
-        ln = dwin->lines[i];
+    // Only lines from the visible ones up to the tallest picture's
+    // height above them can have a picture which is seen.
+    int last = std::min(dwin->scrollmax, dwin->scrollpos + dwin->height + dwin->tallest_picture / gli_leading);
+
+    for (i = dwin->scrollpos; i <= last; i++) {
+        const tbline_t &ln = std::as_const(dwin->lines)[i];
 
         y = y0 + (dwin->height - (i - dwin->scrollpos) - 1) * gli_leading;
 
@@ -720,34 +1411,6 @@ void win_textbuffer_redraw(window_t *win)
     }
 }
 
-static void scrollresize(window_textbuffer_t *dwin)
-{
-    int i;
-
-    dwin->lines.resize(dwin->scrollback + SCROLLBACK);
-
-    dwin->chars = dwin->lines[0].chars.data();
-    dwin->attrs = dwin->lines[0].attrs.data();
-
-    for (i = dwin->scrollback; i < (dwin->scrollback + SCROLLBACK); i++) {
-        dwin->lines[i].dirty = false;
-        dwin->lines[i].repaint = false;
-        dwin->lines[i].lm = 0;
-        dwin->lines[i].rm = 0;
-        dwin->lines[i].lpic.reset();
-        dwin->lines[i].rpic.reset();
-        dwin->lines[i].lhyper = 0;
-        dwin->lines[i].rhyper = 0;
-        dwin->lines[i].len = 0;
-        dwin->lines[i].flow_break_pos.reset();
-        dwin->lines[i].newline = false;
-        dwin->lines[i].chars.fill(' ');
-        dwin->lines[i].attrs.fill(attr_t{});
-    }
-
-    dwin->scrollback += SCROLLBACK;
-}
-
 static void scrolloneline(window_textbuffer_t *dwin, bool forced, bool flow_break = false)
 {
     int i;
@@ -766,9 +1429,12 @@ static void scrolloneline(window_textbuffer_t *dwin, bool forced, bool flow_brea
     dwin->lastseen += lines_to_scroll;
     dwin->scrollmax += lines_to_scroll;
 
-    if (dwin->scrollmax > dwin->scrollback - lines_to_scroll
-            || dwin->lastseen > dwin->scrollback - lines_to_scroll) {
-        scrollresize(dwin);
+    // Trimming drops the oldest lines, so any history older still,
+    // waiting to be laid out, no longer follows on from what's left.
+    if (dwin->scrollback != 0 && dwin->scrollmax > dwin->scrollback) {
+        dwin->scrollmax = dwin->scrollback;
+        dwin->lines.trim(dwin->scrollback + 1);
+        dwin->paragraphs.clear();
     }
 
     if (dwin->lastseen >= dwin->height) {
@@ -787,18 +1453,17 @@ static void scrolloneline(window_textbuffer_t *dwin, bool forced, bool flow_brea
     }
     dwin->spaced = 0;
 
+    store_last_line(dwin);
     auto &line_0 = dwin->lines[0];
-    line_0.len = dwin->numchars;
     line_0.newline = forced;
     if (flow_break) {
         line_0.flow_break_pos = line_0.len;
     }
 
-    for (i = dwin->scrollback - 1; i > lines_to_scroll - 1; i--) {
-        dwin->lines[i] = dwin->lines[i - lines_to_scroll];
-        if (i < dwin->height) {
-            touch(dwin, i);
-        }
+    dwin->lines.scroll(lines_to_scroll, dwin->scrollmax - lines_to_scroll + 1);
+
+    for (i = lines_to_scroll; i < dwin->height && i < SCROLLBACK; i++) {
+        touch(dwin, i);
     }
 
     if (flow_break) {
@@ -821,7 +1486,7 @@ static void scrolloneline(window_textbuffer_t *dwin, bool forced, bool flow_brea
 
     for (i = 0; i < lines_to_scroll; i++) {
         touch(dwin, i);
-        dwin->lines[i].len = 0;
+        dwin->lines[i].clear_text();
         dwin->lines[i].flow_break_pos.reset();
         dwin->lines[i].newline = false;
         dwin->lines[i].lm = dwin->ladjw;
@@ -830,10 +1495,10 @@ static void scrolloneline(window_textbuffer_t *dwin, bool forced, bool flow_brea
         dwin->lines[i].rpic.reset();
         dwin->lines[i].lhyper = 0;
         dwin->lines[i].rhyper = 0;
-        dwin->lines[i].chars.fill(' ');
-        dwin->lines[i].attrs.fill(attr_t{});
     }
 
+    dwin->chars.fill(' ');
+    dwin->attrs.fill(attr_t{});
     dwin->numchars = 0;
 
     touchscroll(dwin);
@@ -849,11 +1514,11 @@ static void put_text(window_textbuffer_t *dwin, const char *buf, int len, int po
     }
 
     if (diff != 0 && pos + oldlen < dwin->numchars) {
-        std::memmove(dwin->chars + pos + len,
-                dwin->chars + pos + oldlen,
+        std::memmove(dwin->chars.data() + pos + len,
+                dwin->chars.data() + pos + oldlen,
                 (dwin->numchars - (pos + oldlen)) * 4);
-        std::memmove(dwin->attrs + pos + len,
-                dwin->attrs + pos + oldlen,
+        std::memmove(dwin->attrs.data() + pos + len,
+                dwin->attrs.data() + pos + oldlen,
                 (dwin->numchars - (pos + oldlen)) * sizeof(attr_t));
     }
     if (len > 0) {
@@ -864,6 +1529,7 @@ static void put_text(window_textbuffer_t *dwin, const char *buf, int len, int po
         }
     }
     dwin->numchars += diff;
+    dwin->wrap.seen = -1;
 
     if (dwin->inbuf != nullptr) {
         if (dwin->incurs >= pos + oldlen) {
@@ -885,21 +1551,22 @@ static void put_text_uni(window_textbuffer_t *dwin, glui32 *buf, int len, int po
     }
 
     if (diff != 0 && pos + oldlen < dwin->numchars) {
-        std::memmove(dwin->chars + pos + len,
-                dwin->chars + pos + oldlen,
+        std::memmove(dwin->chars.data() + pos + len,
+                dwin->chars.data() + pos + oldlen,
                 (dwin->numchars - (pos + oldlen)) * 4);
-        std::memmove(dwin->attrs + pos + len,
-                dwin->attrs + pos + oldlen,
+        std::memmove(dwin->attrs.data() + pos + len,
+                dwin->attrs.data() + pos + oldlen,
                 (dwin->numchars - (pos + oldlen)) * sizeof(attr_t));
     }
     if (len > 0) {
         int i;
-        std::memmove(dwin->chars + pos, buf, len * 4);
+        std::memmove(dwin->chars.data() + pos, buf, len * 4);
         for (i = 0; i < len; i++) {
             dwin->attrs[pos + i].set(style_Input);
         }
     }
     dwin->numchars += diff;
+    dwin->wrap.seen = -1;
 
     if (dwin->inbuf != nullptr) {
         if (dwin->incurs >= pos + oldlen) {
@@ -933,40 +1600,70 @@ static bool leftquote(std::uint32_t c)
     }
 }
 
-void win_textbuffer_putchar_uni(window_t *win, glui32 ch)
+// Start measuring the last line again from its beginning, because it
+// has been changed other than by appending to it.
+static void rewrap(window_textbuffer_t *dwin)
 {
-    window_textbuffer_t *dwin = win->winbuffer();
+    dwin->wrap = tbwrap_t();
+    dwin->wrap.seen = dwin->numchars;
+
+    for (int i = dwin->numchars - 1; i > 0; i--) {
+        if (dwin->chars[i] == ' ') {
+            dwin->wrap.space = i;
+            break;
+        }
+    }
+}
+
+// Return the width of the first "len" characters of the last line,
+// exactly as calcwidth() would. Attribute runs which have ended are
+// measured once, and so is each glyph of the last run once no further
+// character could change it, so as characters are appended, only the
+// last few need to be measured again.
+static int line_width(window_textbuffer_t *dwin, int len)
+{
+    auto &wrap = dwin->wrap;
+    const glui32 *chars = dwin->chars.data();
+    const attr_t *attrs = dwin->attrs.data();
+
+    if (len < wrap.pos) {
+        wrap.run = 0;
+        wrap.runswidth = 0;
+        wrap.pos = 0;
+        wrap.pen = garglk::TextPen();
+    }
+
+    for (int b = wrap.pos; b < len; b++) {
+        if (attrs[b] != attrs[wrap.run]) {
+            gli_string_advance_uni(attrs[wrap.run].font(dwin->styles), wrap.pen,
+                    chars + wrap.pos, b - wrap.pos, -1, false);
+            wrap.runswidth += wrap.pen.x;
+            wrap.run = b;
+            wrap.pos = b;
+            wrap.pen = garglk::TextPen();
+        }
+    }
+
+    auto font = attrs[wrap.run].font(dwin->styles);
+    wrap.pos += gli_string_advance_uni(font, wrap.pen, chars + wrap.pos, len - wrap.pos, -1, true);
+
+    garglk::TextPen pen = wrap.pen;
+    gli_string_advance_uni(font, pen, chars + wrap.pos, len - wrap.pos, -1, false);
+
+    return wrap.runswidth + pen.x;
+}
+
+// Append a character to the last line, wrapping it if necessary.
+static void put_char(window_textbuffer_t *dwin, glui32 ch)
+{
+    window_t *win = dwin->owner;
     std::array<glui32, TBLINELEN> bchars;
     std::array<attr_t, TBLINELEN> battrs;
     int pw;
     int bpoint;
     int saved;
-    int i;
     int linelen;
 
-    // Don't speak if the current text style is input, under the
-    // assumption that the interpreter is trying to display the user's
-    // input. This is how Bocfel uses style_Input, and without this
-    // test, extraneous input text is spoken. Other formats/interpreters
-    // don't have this issue, but since this affects all Z-machine
-    // games, it's probably worth the hacky solution here. If there are
-    // Glulx games which use input style for text that the user did not
-    // enter, that text will not get spoken. If that turns out to be a
-    // problem, a new Gargoyle-specific function will probably be needed
-    // that Bocfel can use to signal that it's writing input text from
-    // the user vs input text from elsewhere.
-    //
-    // Note that this already affects history playback in Bocfel: since
-    // it styles previous user input with style_Input during history
-    // playback, the user input won't be spoken. That's annoying but
-    // probably not quite as important as getting the expected behavior
-    // during normal gameplay.
-    //
-    // See https://github.com/garglk/garglk/issues/356
-    if (win->attr.style != style_Input) {
-        gli_tts_speak(&ch, 1);
-    }
-
     pw = (win->bbox.x1 - win->bbox.x0 - gli_tmarginx * 2 - gli_scroll_width) * GLI_SUBPIX;
     pw = pw - 2 * SLOP - dwin->radjw - dwin->ladjw;
 
@@ -1059,16 +1756,25 @@ void win_textbuffer_putchar_uni(window_t *win, glui32 ch)
                 dwin->spaced = 2;
             } else if (ch != ' ' && dwin->spaced == 2) {
                 dwin->spaced = 0;
-                win_textbuffer_putchar_uni(win, ' ');
+                put_char(dwin, ' ');
             } else {
                 dwin->spaced = 0;
             }
         }
     }
 
+    if (dwin->wrap.seen != dwin->numchars) {
+        rewrap(dwin);
+    }
+
+    if (ch == ' ' && dwin->numchars > 0) {
+        dwin->wrap.space = dwin->numchars;
+    }
+
     dwin->chars[dwin->numchars] = ch;
     dwin->attrs[dwin->numchars] = win->attr;
     dwin->numchars++;
+    dwin->wrap.seen = dwin->numchars;
 
     // kill spaces at the end for line width calculation
     linelen = dwin->numchars;
@@ -1078,32 +1784,71 @@ void win_textbuffer_putchar_uni(window_t *win, glui32 ch)
         linelen--;
     }
 
-    if (calcwidth(dwin, dwin->chars, dwin->attrs, 0, linelen, -1) >= pw) {
+    if (line_width(dwin, linelen) >= pw) {
         bpoint = dwin->numchars;
 
-        for (i = dwin->numchars - 1; i > 0; i--) {
-            if (dwin->chars[i] == ' ') {
-                bpoint = i + 1; // skip space
-                break;
-            }
+        if (dwin->wrap.space != 0) {
+            bpoint = dwin->wrap.space + 1; // skip space
         }
 
         saved = dwin->numchars - bpoint;
 
-        std::memcpy(bchars.data(), dwin->chars + bpoint, saved * 4);
-        std::memcpy(battrs.data(), dwin->attrs + bpoint, saved * sizeof(attr_t));
+        std::memcpy(bchars.data(), dwin->chars.data() + bpoint, saved * 4);
+        std::memcpy(battrs.data(), dwin->attrs.data() + bpoint, saved * sizeof(attr_t));
         dwin->numchars = bpoint;
 
         scrolloneline(dwin, false);
 
-        std::memcpy(dwin->chars, bchars.data(), saved * 4);
-        std::memcpy(dwin->attrs, battrs.data(), saved * sizeof(attr_t));
+        std::memcpy(dwin->chars.data(), bchars.data(), saved * 4);
+        std::memcpy(dwin->attrs.data(), battrs.data(), saved * sizeof(attr_t));
         dwin->numchars = saved;
+        rewrap(dwin);
+    }
+}
+
+void win_textbuffer_putbuffer_uni(window_t *win, const glui32 *buf, std::size_t len)
+{
+    window_textbuffer_t *dwin = win->winbuffer();
+
+    if (len == 0) {
+        return;
+    }
+
+    // Don't speak if the current text style is input, under the
+    // assumption that the interpreter is trying to display the user's
+    // input. This is how Bocfel uses style_Input, and without this
+    // test, extraneous input text is spoken. Other formats/interpreters
+    // don't have this issue, but since this affects all Z-machine
+    // games, it's probably worth the hacky solution here. If there are
+    // Glulx games which use input style for text that the user did not
+    // enter, that text will not get spoken. If that turns out to be a
+    // problem, a new Gargoyle-specific function will probably be needed
+    // that Bocfel can use to signal that it's writing input text from
+    // the user vs input text from elsewhere.
+    //
+    // Note that this already affects history playback in Bocfel: since
+    // it styles previous user input with style_Input during history
+    // playback, the user input won't be spoken. That's annoying but
+    // probably not quite as important as getting the expected behavior
+    // during normal gameplay.
+    //
+    // See https://github.com/garglk/garglk/issues/356
+    if (win->attr.style != style_Input) {
+        gli_tts_speak(buf, len);
+    }
+
+    for (std::size_t i = 0; i < len; i++) {
+        put_char(dwin, buf[i]);
     }
 
     touch(dwin, 0);
 }
 
+void win_textbuffer_putchar_uni(window_t *win, glui32 ch)
+{
+    win_textbuffer_putbuffer_uni(win, &ch, 1);
+}
+
 bool win_textbuffer_unputchar_uni(window_t *win, glui32 ch)
 {
     window_textbuffer_t *dwin = win->winbuffer();
@@ -1131,9 +1876,11 @@ void win_textbuffer_clear(window_t *win)
     dwin->dashed = 0;
 
     dwin->numchars = 0;
+    dwin->paragraphs.clear();
+    dwin->lines.clear_old();
 
-    for (i = 0; i < dwin->scrollback; i++) {
-        dwin->lines[i].len = 0;
+    for (i = 0; i < SCROLLBACK; i++) {
+        dwin->lines[i].clear_text();
         dwin->lines[i].flow_break_pos.reset();
 
         dwin->lines[i].lpic.reset();
@@ -1234,7 +1981,7 @@ void win_textbuffer_cancel_line(window_t *win, event_t *ev)
 
     len = dwin->numchars - dwin->infence;
     if (win->echostr != nullptr) {
-        gli_stream_echo_line_uni(win->echostr, dwin->chars + dwin->infence, len);
+        gli_stream_echo_line_uni(win->echostr, dwin->chars.data() + dwin->infence, len);
     }
 
     if (len > inmax) {
@@ -1321,6 +2068,8 @@ bool gcmd_accept_scroll(window_t *win, glui32 arg)
         break;
     }
 
+    win_textbuffer_reflow_history(dwin, dwin->scrollpos + dwin->height);
+
     if (dwin->scrollpos > dwin->scrollmax - dwin->height + 1) {
         dwin->scrollpos = dwin->scrollmax - dwin->height + 1;
     }
@@ -1395,12 +2144,12 @@ static void acceptline(window_t *win, glui32 keycode)
 
     len = dwin->numchars - dwin->infence;
     if (win->echostr != nullptr) {
-        gli_stream_echo_line_uni(win->echostr, dwin->chars + dwin->infence, len);
+        gli_stream_echo_line_uni(win->echostr, dwin->chars.data() + dwin->infence, len);
     }
 
     gli_tts_purge();
     if (gli_conf_speak_input) {
-        gli_tts_speak(dwin->chars + dwin->infence, len);
+        gli_tts_speak(dwin->chars.data() + dwin->infence, len);
         std::array<glui32, 1> newline = {'\n'};
         gli_tts_speak(newline.data(), 1);
     }
@@ -1646,6 +2395,8 @@ void gcmd_buffer_accept_readline(window_t *win, glui32 arg)
 
 static bool put_picture(window_textbuffer_t *dwin, const std::shared_ptr<picture_t> &pic, glui32 align, glui32 linkval)
 {
+    dwin->tallest_picture = std::max(dwin->tallest_picture, pic->h);
+
     if (align == imagealign_MarginRight) {
         if (dwin->lines[0].rpic || dwin->numchars != 0) {
             return false;
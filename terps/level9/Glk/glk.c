@@ -2259,6 +2259,11 @@ gln_graphics_paint_everything (winid_t glk_window,
 			int x_offset, int y_offset,
 			gln_uint16 width, gln_uint16 height)
 {
+#ifdef GLK_MODULE_GARGLKPIXELS
+	garglk_window_draw_pixels (glk_window, off_screen, pixels_Indexed,
+			width, palette, x_offset, y_offset,
+			width, height, GLN_GRAPHICS_PIXEL);
+#else
 	gln_byte		pixel;			/* Reference pixel color */
 	int		x, y;
 
@@ -2274,6 +2279,7 @@ gln_graphics_paint_everything (winid_t glk_window,
 			GLN_GRAPHICS_PIXEL, GLN_GRAPHICS_PIXEL);
 	    }
 	}
+#endif
 }
 
 /*
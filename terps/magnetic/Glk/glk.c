@@ -1849,6 +1849,11 @@ gms_graphics_paint_everything (winid_t glk_window, glui32 palette[],
                               type8 off_screen[], int x_offset,
                               int y_offset, type16 width, type16 height)
 {
+#ifdef GLK_MODULE_GARGLKPIXELS
+  garglk_window_draw_pixels (glk_window, off_screen, pixels_Indexed, width,
+                             palette, x_offset, y_offset, width, height,
+                             gms_graphics_pixel);
+#else
   type8 pixel; /* Reference pixel color */
   int x, y;
 
@@ -1864,6 +1869,7 @@ gms_graphics_paint_everything (winid_t glk_window, glui32 palette[],
                                 gms_graphics_pixel, gms_graphics_pixel);
         }
     }
+#endif
 }
 #endif
 
@@ -236,6 +236,9 @@ int DrawApple2Image(USImage *image)
 
 static void PutApplePixel(glsi32 xpos, glsi32 ypos, glui32 color)
 {
+    if (BatchPixels(xpos, ypos, color, 1))
+        return;
+
     xpos = xpos * pixel_size;
     xpos += x_offset;
 
@@ -303,6 +306,8 @@ void DrawApple2ImageFromVideoMem(void)
     vram_row[0] = 0;
     vram_row[41] = 0;
 
+    OpenPixelBatch();
+
     for (int row = 0; row < ImageHeight; row++) {
         for (int col = 0; col < 40; col++) {
             int const offset = ((((row / 8) & 0x07) << 7) | (((row / 8) & 0x18) * 5 + col)) | ((row & 7) << 10);
@@ -324,4 +329,6 @@ void DrawApple2ImageFromVideoMem(void)
             }
         }
     }
+
+    ClosePixelBatch();
 }
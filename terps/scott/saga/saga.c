@@ -129,14 +129,17 @@ uint8_t *ReadUSDictionary(uint8_t *ptr)
 
 int DrawUSImage(USImage *image)
 {
+    int result = 0;
     last_image_index = image->index;
+    OpenPixelBatch();
     if (image->systype == SYS_MSDOS)
-        return DrawDOSImage(image);
+        result = DrawDOSImage(image);
     else if (image->systype == SYS_C64 || image->systype == SYS_ATARI8)
-        return DrawAtariC64Image(image);
+        result = DrawAtariC64Image(image);
     else if (image->systype == SYS_APPLE2)
-        return DrawApple2Image(image);
-    return 0;
+        result = DrawApple2Image(image);
+    ClosePixelBatch();
+    return result;
 }
 
 void DrawInventoryImages(void)
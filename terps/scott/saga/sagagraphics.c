@@ -61,6 +61,104 @@ void SetRGB(int32_t index, int red, int green, int blue)
     pal[index][2] = blue;
 }
 
+#ifdef GLK_MODULE_GARGLKPIXELS
+/*
+ * While a batch is open, pixels are collected here and drawn with a single
+ * garglk_window_draw_pixels() call when it is closed, rather than one
+ * glk_window_fill_rect() per pixel. Unset pixels are 0xffffffff, which
+ * draw_pixels treats as transparent.
+ */
+#define BATCH_WIDTH 320
+#define BATCH_HEIGHT 200
+
+static glui32 *batch = NULL;
+static int batch_depth = 0;
+static int batch_left, batch_top, batch_right, batch_bottom;
+
+static void ResetPixelBatch(void)
+{
+    batch_left = BATCH_WIDTH;
+    batch_top = BATCH_HEIGHT;
+    batch_right = 0;
+    batch_bottom = 0;
+}
+
+static void FlushPixelBatch(void)
+{
+    if (batch_left >= batch_right || batch_top >= batch_bottom)
+        return;
+
+    if (Graphics != NULL)
+        garglk_window_draw_pixels(Graphics,
+            &batch[batch_top * BATCH_WIDTH + batch_left], pixels_RGB,
+            BATCH_WIDTH, NULL, batch_left * pixel_size + x_offset,
+            batch_top * pixel_size + y_offset, batch_right - batch_left,
+            batch_bottom - batch_top, pixel_size);
+
+    for (int y = batch_top; y < batch_bottom; y++)
+        memset(&batch[y * BATCH_WIDTH + batch_left], 0xff,
+            (batch_right - batch_left) * sizeof(glui32));
+
+    ResetPixelBatch();
+}
+#endif
+
+void OpenPixelBatch(void)
+{
+#ifdef GLK_MODULE_GARGLKPIXELS
+    if (batch == NULL) {
+        batch = MemAlloc(BATCH_WIDTH * BATCH_HEIGHT * sizeof(glui32));
+        memset(batch, 0xff, BATCH_WIDTH * BATCH_HEIGHT * sizeof(glui32));
+    }
+    if (batch_depth++ == 0)
+        ResetPixelBatch();
+#endif
+}
+
+void ClosePixelBatch(void)
+{
+#ifdef GLK_MODULE_GARGLKPIXELS
+    if (batch_depth == 0 || --batch_depth > 0)
+        return;
+    FlushPixelBatch();
+#endif
+}
+
+/*
+ * Store count pixels of color in a row starting at (xpos, ypos) in the open
+ * batch. Returns 0 if the caller has to draw them itself, either because no
+ * batch is open or because they don't fit in it. In the latter case the batch
+ * is flushed first, so everything is still drawn in order.
+ */
+int BatchPixels(glsi32 xpos, glsi32 ypos, glui32 color, int count)
+{
+#ifdef GLK_MODULE_GARGLKPIXELS
+    if (batch_depth == 0)
+        return 0;
+
+    if (xpos < 0 || ypos < 0 || xpos + count > BATCH_WIDTH || ypos >= BATCH_HEIGHT) {
+        FlushPixelBatch();
+        return 0;
+    }
+
+    for (int i = 0; i < count; i++)
+        batch[ypos * BATCH_WIDTH + xpos + i] = color;
+
+    if (xpos < batch_left)
+        batch_left = xpos;
+    if (xpos + count > batch_right)
+        batch_right = xpos + count;
+    if (ypos < batch_top)
+        batch_top = ypos;
+    if (ypos + 1 > batch_bottom)
+        batch_bottom = ypos + 1;
+
+    return 1;
+#else
+    return 0;
+#endif
+}
+
 void PutPixel(glsi32 xpos, glsi32 ypos, int32_t color)
 {
     if (xpos < 0 || xpos > right_margin || xpos < left_margin) {
@@ -68,6 +166,9 @@ void PutPixel(glsi32 xpos, glsi32 ypos, int32_t color)
     }
     glui32 glk_color = ((pal[color][0] << 16)) | ((pal[color][1] << 8)) | (pal[color][2]);
 
+    if (BatchPixels(xpos, ypos, glk_color, 1))
+        return;
+
     glk_window_fill_rect(Graphics, glk_color, xpos * pixel_size + x_offset,
         ypos * pixel_size + y_offset, pixel_size, pixel_size);
 }
@@ -79,6 +180,9 @@ void PutDoublePixel(glsi32 xpos, glsi32 ypos, int32_t color)
     }
     glui32 glk_color = ((pal[color][0] << 16)) | ((pal[color][1] << 8)) | (pal[color][2]);
 
+    if (BatchPixels(xpos, ypos, glk_color, 2))
+        return;
+
     glk_window_fill_rect(Graphics, glk_color, xpos * pixel_size + x_offset,
         ypos * pixel_size + y_offset, pixel_size * 2, pixel_size);
 }
@@ -49,6 +49,10 @@ void SetRGB(int32_t index, int red, int green, int blue);
 void PutPixel(glsi32 x, glsi32 y, int32_t color);
 void PutDoublePixel(glsi32 xpos, glsi32 ypos, int32_t color);
 
+void OpenPixelBatch(void);
+void ClosePixelBatch(void);
+int BatchPixels(glsi32 xpos, glsi32 ypos, glui32 color, int count);
+
 USImage *new_image(void);
 int issagaimg(const char *name);
 int has_graphics(void);